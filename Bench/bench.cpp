@@ -0,0 +1,267 @@
+#include "particles.h"
+#include "integrator.h"
+#include "jobs.h"
+#include "checkpoint.h"
+#include "cull.h"
+#include "energy.h"
+#include "simulation.h"
+#include "stl.h"
+#include "weld.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Headless benchmark of the particle step: no window, no GL context.
+// Prints one JSON object on stdout.
+
+struct Options
+{
+	int particles = 1000000;
+	int steps = 100;
+	int warmup = 5;
+	unsigned threads = 0;
+	std::size_t chunk = 0;
+	bool pin = false;
+	bool reorder = true;
+	float dt = 1.f / 120.f;
+	std::string integrator = "auto";
+	std::string mode = "uniform";
+	std::string scheme = "euler";
+	IntegratorVariant variant = IntegratorVariant::Auto;
+	SimulationMode simulationMode = SimulationMode::Uniform;
+	IntegrationScheme integrationScheme = IntegrationScheme::SemiImplicitEuler;
+	bool drift = false; // only run the energy drift test of the schemes
+	std::string mesh; // binary STL to collide with, empty for none
+	std::string record; // checkpoint file written every step, outside of the timings
+	bool quantize = false;
+	bool sleep = false; // let the particles settled on the mesh sleep
+};
+
+static void usage()
+{
+	std::cerr << "usage: Bench [--particles N] [--steps N] [--warmup N] [--threads WORKERS] [--chunk N] [--pin]\n"
+		"             [--integrator auto|scalar|sse4|avx2] [--mode uniform|barneshut|fluid]\n"
+		"             [--scheme euler|verlet|kdk] [--drift]\n"
+		"             [--dt SECONDS] [--no-reorder] [--mesh FILE.stl [--sleep]]\n"
+		"             [--record FILE [--quantize]]" << std::endl;
+}
+
+static bool parse(int argc, char** argv, Options& o)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (arg == "--particles" && hasValue) o.particles = std::atoi(argv[++i]);
+		else if (arg == "--steps" && hasValue) o.steps = std::atoi(argv[++i]);
+		else if (arg == "--warmup" && hasValue) o.warmup = std::atoi(argv[++i]);
+		else if (arg == "--threads" && hasValue) o.threads = unsigned(std::atoi(argv[++i]));
+		else if (arg == "--chunk" && hasValue) o.chunk = std::size_t(std::atoll(argv[++i]));
+		else if (arg == "--dt" && hasValue) o.dt = float(std::atof(argv[++i]));
+		else if (arg == "--integrator" && hasValue) o.integrator = argv[++i];
+		else if (arg == "--mode" && hasValue) o.mode = argv[++i];
+		else if (arg == "--scheme" && hasValue) o.scheme = argv[++i];
+		else if (arg == "--drift") o.drift = true;
+		else if (arg == "--mesh" && hasValue) o.mesh = argv[++i];
+		else if (arg == "--record" && hasValue) o.record = argv[++i];
+		else if (arg == "--quantize") o.quantize = true;
+		else if (arg == "--sleep") o.sleep = true;
+		else if (arg == "--pin") o.pin = true;
+		else if (arg == "--no-reorder") o.reorder = false;
+		else return false;
+	}
+	if (o.integrator == "auto") o.variant = IntegratorVariant::Auto;
+	else if (o.integrator == "scalar") o.variant = IntegratorVariant::Scalar;
+	else if (o.integrator == "sse4") o.variant = IntegratorVariant::SSE4;
+	else if (o.integrator == "avx2") o.variant = IntegratorVariant::AVX2;
+	else return false;
+
+	if (o.mode == "uniform") o.simulationMode = SimulationMode::Uniform;
+	else if (o.mode == "barneshut") o.simulationMode = SimulationMode::BarnesHut;
+	else if (o.mode == "fluid") o.simulationMode = SimulationMode::Fluid;
+	else return false;
+
+	if (o.scheme == "euler") o.integrationScheme = IntegrationScheme::SemiImplicitEuler;
+	else if (o.scheme == "verlet") o.integrationScheme = IntegrationScheme::VelocityVerlet;
+	else if (o.scheme == "kdk") o.integrationScheme = IntegrationScheme::LeapfrogKDK;
+	else return false;
+
+	// Only particles settled on a mesh sleep
+	if (o.sleep && o.mesh.empty())
+		return false;
+
+	return o.particles > 0 && o.steps > 0;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	// Nearest rank
+	const std::size_t rank = std::size_t(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+// Largest energy drift of every scheme over 4 s of the reference orbits, for
+// a range of steps: the step a scheme can take for the drift Euler has at a
+// smaller one
+static void driftTest()
+{
+	const IntegrationScheme schemes[] = { IntegrationScheme::SemiImplicitEuler, IntegrationScheme::VelocityVerlet, IntegrationScheme::LeapfrogKDK };
+	const float steps[] = { 1.f / 960.f, 1.f / 480.f, 1.f / 240.f, 1.f / 120.f, 1.f / 60.f };
+	const double duration = 4.0;
+
+	std::cout << "{\n  \"duration_s\": " << duration << ",\n  \"energy_drift\": {\n";
+	for (int s = 0; s < 3; s++)
+	{
+		std::cout << "    \"" << SchemeName(schemes[s]) << "\": {";
+		for (int k = 0; k < 5; k++)
+		{
+			const double drift = EnergyDriftTest(schemes[s], steps[k], int(duration / steps[k] + 0.5));
+			std::cout << (k ? ", " : " ") << "\"" << steps[k] << "\": " << drift;
+		}
+		std::cout << " }" << (s < 2 ? "," : "") << "\n";
+	}
+	std::cout << "  }\n}" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	Options o;
+	if (!parse(argc, argv, o))
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (o.drift)
+	{
+		driftTest();
+		return EXIT_SUCCESS;
+	}
+
+	const IntegratorVariant variant = o.variant;
+	const SimulationMode mode = o.simulationMode;
+	const IntegrationScheme scheme = o.integrationScheme;
+
+	JobSystem jobs(o.threads, o.pin);
+	ParticleStore particules = MakeParticules(o.particles, 0, &jobs);
+
+	Simulation simulation(particules, jobs);
+	simulation.settings.integrate = SelectIntegrator(variant);
+	simulation.settings.chunk = o.chunk;
+	simulation.settings.mode = mode;
+	simulation.settings.scheme = scheme;
+	simulation.settings.reorder = o.reorder;
+	if (mode == SimulationMode::Fluid)
+		simulation.Fluid().Reserve(particules.Capacity());
+	std::size_t meshBytes = 0;
+	IndexedMesh welded;
+	double weldMs = 0.0;
+	if (!o.mesh.empty())
+	{
+		// Same placement as the viewer gives logo.stl
+		const std::vector<Triangle> triangles = ReadStl(o.mesh.c_str(), &jobs);
+		if (triangles.empty())
+		{
+			std::cerr << "cannot read " << o.mesh << std::endl;
+			return EXIT_FAILURE;
+		}
+		simulation.collider.Build(triangles, LayMeshFlat(triangles, 1.6f, -0.4f));
+
+		// What an indexed copy of the mesh would save
+		const auto start = std::chrono::steady_clock::now();
+		welded = WeldMesh(triangles, 0.f, &jobs);
+		weldMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		meshBytes = triangles.size() * sizeof(Triangle);
+		simulation.settings.collide = true;
+		simulation.settings.sleep = o.sleep;
+	}
+
+	const bool verified = VerifyIntegrator(simulation.settings.integrate);
+	const CullKernel culler = SelectCuller();
+	const bool cullerVerified = VerifyCuller(culler);
+
+	CheckpointRecorder recorder;
+	recorder.quantize = o.quantize;
+	if (!o.record.empty() && !recorder.Open(o.record.c_str()))
+	{
+		std::cerr << "cannot write " << o.record << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	for (int s = 0; s < o.warmup; s++)
+		simulation.Step(o.dt);
+
+	// Outside of the timings: in Barnes-Hut mode a measure costs a tree walk
+	simulation.energy.Sample(simulation.MeasureEnergy());
+
+	std::vector<double> ns(o.steps);
+	std::size_t contacts = 0;
+	for (int s = 0; s < o.steps; s++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		simulation.Step(o.dt);
+		const auto end = std::chrono::steady_clock::now();
+		ns[s] = std::chrono::duration<double, std::nano>(end - start).count();
+		contacts += simulation.Contacts();
+		recorder.Record(particules, std::uint64_t(s), s * double(o.dt), jobs);
+	}
+	recorder.Close();
+	simulation.energy.Sample(simulation.MeasureEnergy());
+
+	double total = 0.0;
+	for (const auto t : ns)
+		total += t;
+	std::sort(ns.begin(), ns.end());
+
+	const double n = double(particules.Size());
+	const double mean = total / o.steps;
+
+	// The uniform step reads px, py, pz, vx, vy, vz, mass and writes px, py, pz, vy.
+	// A mesh adds the collision pass and lets particles sleep: no model then
+	const double bytesPerParticle = 11 * sizeof(float);
+	const bool bandwidthModel = mode == SimulationMode::Uniform && o.mesh.empty();
+
+	std::cout << "{\n"
+		<< "  \"particles\": " << particules.Size() << ",\n"
+		<< "  \"steps\": " << o.steps << ",\n"
+		<< "  \"worker_threads\": " << jobs.WorkerCount() << ",\n"
+		<< "  \"integrator\": \"" << IntegratorName(simulation.settings.integrate) << "\",\n"
+		<< "  \"integrator_verified\": " << (verified ? "true" : "false") << ",\n"
+		<< "  \"culler\": \"" << CullerName(culler) << "\",\n"
+		<< "  \"culler_verified\": " << (cullerVerified ? "true" : "false") << ",\n"
+		<< "  \"mode\": \"" << o.mode << "\",\n"
+		<< "  \"scheme\": \"" << SchemeName(scheme) << "\",\n"
+		<< "  \"ns_per_particle_step\": " << mean / n << ",\n"
+		<< "  \"step_ms\": {\n"
+		<< "    \"mean\": " << mean * 1e-6 << ",\n"
+		<< "    \"min\": " << ns.front() * 1e-6 << ",\n"
+		<< "    \"p50\": " << percentile(ns, 50) * 1e-6 << ",\n"
+		<< "    \"p90\": " << percentile(ns, 90) * 1e-6 << ",\n"
+		<< "    \"p99\": " << percentile(ns, 99) * 1e-6 << ",\n"
+		<< "    \"max\": " << ns.back() * 1e-6 << "\n"
+		<< "  },\n";
+	if (bandwidthModel)
+		std::cout << "  \"bandwidth_gb_s\": " << bytesPerParticle * n / mean << ",\n";
+	else
+		std::cout << "  \"bandwidth_gb_s\": null,\n";
+	std::cout << "  \"triangles\": " << simulation.collider.Tree().TriangleCount() << ",\n"
+		<< "  \"mesh_kb\": " << meshBytes / 1024 << ",\n"
+		<< "  \"welded_vertices\": " << welded.vertices.size() << ",\n"
+		<< "  \"welded_kb\": " << welded.Bytes() / 1024 << ",\n"
+		<< "  \"weld_ms\": " << weldMs << ",\n"
+		<< "  \"contacts\": " << contacts << ",\n"
+		<< "  \"sleeping\": " << simulation.sleep.Sleeping() << ",\n"
+		<< "  \"recorded_bytes\": " << recorder.Bytes() << ",\n"
+		<< "  \"record_waits\": " << recorder.Waits() << ",\n"
+		<< "  \"energy_drift\": " << simulation.energy.Drift() << ",\n"
+		<< "  \"reorders\": " << simulation.reorder.Reorders() << "\n"
+		<< "}" << std::endl;
+
+	return verified && cullerVerified ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,246 @@
+#include "compute.h"
+#include "particles.h"
+#include "upload.h"
+
+#if defined(_WIN32)
+#include <GLFW/glfw3.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Headless checks of the GL paths: shader.comp against the CPU step, and the
+// upload ring. No window: on Linux the context is a surfaceless EGL one, so
+// CI runs it on llvmpipe without a display (LIBGL_ALWAYS_SOFTWARE=1); on
+// Windows it is a hidden GLFW window. Exits non-zero when a check fails.
+
+struct Options
+{
+	std::string shaders = "../OpenGLZ"; // directory of shader.comp
+	int particles = 1021; // odd so the last work group is partial
+	int steps = 240;
+	int frames = 30; // upload ring frames, several times round the ring
+};
+
+static void usage()
+{
+	std::cerr << "usage: GpuCheck [--shaders DIR] [--particles N] [--steps N] [--frames N]" << std::endl;
+}
+
+static bool parse(int argc, char** argv, Options& o)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (arg == "--shaders" && hasValue) o.shaders = argv[++i];
+		else if (arg == "--particles" && hasValue) o.particles = std::atoi(argv[++i]);
+		else if (arg == "--steps" && hasValue) o.steps = std::atoi(argv[++i]);
+		else if (arg == "--frames" && hasValue) o.frames = std::atoi(argv[++i]);
+		else return false;
+	}
+	return o.particles > 0 && o.steps > 0 && o.frames > 0;
+}
+
+// GL 4.5 core context without anything on screen
+class HeadlessContext
+{
+public:
+	~HeadlessContext() { destroy(); }
+
+	bool Create()
+	{
+#if defined(_WIN32)
+		if (!glfwInit())
+			return false;
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(16, 16, "GpuCheck", nullptr, nullptr);
+		if (!window)
+			return false;
+		glfwMakeContextCurrent(window);
+		return gladLoadGLLoader((GLADloadproc) glfwGetProcAddress) != 0;
+#else
+		// Surfaceless platform when Mesa has it, the default display otherwise
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API))
+			return false;
+
+		const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_NONE };
+		EGLConfig config;
+		EGLint configs = 0;
+		if (!eglChooseConfig(display, configAttributes, &config, 1, &configs) || configs == 0)
+			return false;
+
+		const EGLint contextAttributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, 5,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+			return false;
+		return gladLoadGLLoader((GLADloadproc) eglGetProcAddress) != 0;
+#endif
+	}
+
+private:
+	void destroy()
+	{
+#if defined(_WIN32)
+		if (window)
+			glfwDestroyWindow(window);
+		glfwTerminate();
+#else
+		if (display == EGL_NO_DISPLAY)
+			return;
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context != EGL_NO_CONTEXT)
+			eglDestroyContext(display, context);
+		eglTerminate(display);
+#endif
+	}
+
+#if defined(_WIN32)
+	GLFWwindow* window = nullptr;
+#else
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+// Compute program of a shader file, 0 with the compiler log on failure
+static GLuint computeProgram(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "cannot read " << path << std::endl;
+		return 0;
+	}
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	const std::string source = contents.str();
+	const char* data = source.data();
+	const GLint size = GLint(source.size());
+
+	const GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &data, &size);
+	glCompileShader(shader);
+
+	const GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader);
+
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		GLchar log[1024];
+		glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+		std::cerr << path << ": " << log << std::endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+static std::uint8_t pattern(int frame, std::size_t i, int k)
+{
+	return std::uint8_t(frame * 31 + i * 7 + k);
+}
+
+// Writes every frame through an UploadRing, then copies its region on the GPU
+// to a buffer of its own: the copies read what their frame wrote only if the
+// coherent mapping needs no flush and the regions go round as Offset says.
+// Going several times round the ring also runs the fence waits, though a
+// driver finishing the copies before Begin (llvmpipe does) never stalls.
+static bool checkUploadRing(std::size_t n, int frames, long long& stalls)
+{
+	const std::size_t regionSize = n * sizeof(PackedParticule);
+	UploadRing ring;
+	ring.Create(regionSize);
+
+	GLuint copies = 0;
+	glCreateBuffers(1, &copies);
+	glNamedBufferStorage(copies, frames * regionSize, nullptr, 0);
+
+	bool ok = true;
+	for (int f = 0; f < frames; f++)
+	{
+		auto mapped = (std::uint8_t*) ring.Begin();
+		ok = ok && ring.Offset() == std::size_t(f % UploadRing::Regions) * regionSize;
+		for (std::size_t b = 0; b < regionSize; b++)
+			mapped[b] = pattern(f, b / sizeof(PackedParticule), int(b % sizeof(PackedParticule)));
+
+		glCopyNamedBufferSubData(ring.Buffer(), copies, GLintptr(ring.Offset()), GLintptr(f * regionSize), GLsizeiptr(regionSize));
+		ring.End();
+	}
+
+	std::vector<std::uint8_t> read(frames * regionSize);
+	glGetNamedBufferSubData(copies, 0, GLsizeiptr(read.size()), read.data());
+	glDeleteBuffers(1, &copies);
+
+	for (int f = 0; f < frames && ok; f++)
+	{
+		for (std::size_t b = 0; b < regionSize && ok; b++)
+			ok = read[f * regionSize + b] == pattern(f, b / sizeof(PackedParticule), int(b % sizeof(PackedParticule)));
+	}
+
+	stalls = ring.Stalls();
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	Options o;
+	if (!parse(argc, argv, o))
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	HeadlessContext context;
+	if (!context.Create())
+	{
+		std::cerr << "no OpenGL 4.5 context" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "Renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+	const GLuint program = computeProgram(o.shaders + "/shader.comp");
+	if (!program)
+		return EXIT_FAILURE;
+
+	const float error = ComputeParityError(program, std::size_t(o.particles), o.steps, 1.f / 120.f);
+	const bool parity = error <= ComputeParityTolerance;
+	std::cout << "Compute parity: max error " << error << (parity ? " (ok)" : " (FAILED)") << std::endl;
+	glDeleteProgram(program);
+
+	long long stalls = 0;
+	const bool ring = checkUploadRing(std::size_t(o.particles), o.frames, stalls);
+	std::cout << "Upload ring: " << o.frames << " frames, " << stalls << " stalls" << (ring ? " (ok)" : " (FAILED)") << std::endl;
+
+	const GLenum glError = glGetError();
+	if (glError != GL_NO_ERROR)
+		std::cout << "GL error 0x" << std::hex << glError << std::dec << std::endl;
+
+	return parity && ring && glError == GL_NO_ERROR ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,108 +1,426 @@
 #include "OBJLoader.h"
 
-// Very, VERY simple OBJ loader.
-// Here is a short list of features a real function would provide : 
-// - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
-// - Animations & bones (includes bones weights)
-// - Multiple UVs
-// - All attributes should be optional, not "forced"
-// - More stable. Change a line in the OBJ file and it crashes.
-// - More secure. Change another line and you can inject code.
-// - Loading from memory, stream, etc
+#include "jobs.h"
+#include "mapped.h"
+#include "meshparse.h"
 
-bool loadOBJ(
-	const char* path,
-	std::vector<glm::vec3>& out_vertices,
-	std::vector<glm::vec2>& out_uvs,
-	std::vector<glm::vec3>& out_normals
-) {
-	printf("Loading OBJ file %s...\n", path);
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<glm::vec3> temp_vertices;
-	std::vector<glm::vec2> temp_uvs;
-	std::vector<glm::vec3> temp_normals;
+// Element indices of a face corner, from 0, -1 when absent
+struct ObjCorner
+{
+	std::int32_t v, vt, vn;
 
+	bool operator==(const ObjCorner& c) const { return v == c.v && vt == c.vt && vn == c.vn; }
+};
 
-	FILE* file = fopen(path, "r");
-	if (file == NULL) {
-		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
-		return false;
-	}
+// A corner as read in a chunk: absolute indices from 0, or with the relative
+// bit of their element, indices from the first element of the chunk (negative
+// for the elements of the previous chunks). -1 when absent, never relative.
+struct ObjChunkCorner
+{
+	std::int32_t index[3];
+	std::uint8_t relative;
+};
 
-	while (1) {
+// Elements and triangulated face corners of a run of lines
+struct ObjElements
+{
+	std::vector<glm::vec3> v;
+	std::vector<glm::vec2> vt;
+	std::vector<glm::vec3> vn;
+	std::vector<ObjChunkCorner> corners; // three per triangle
 
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
+	// Largest amount by which an absolute index passes the elements read
+	// before its face in the run: the run needs more earlier elements than that
+	std::int64_t ahead[3] = {INT64_MIN, INT64_MIN, INT64_MIN};
+};
 
-		// else : parse lineHeader
+// One-based index, made zero-based, or negative index counting back from
+// the count elements of the chunk, made relative to its first element
+static inline bool parseIndex(const char*& at, const char* end, std::size_t count, std::int32_t& index, bool& relative)
+{
+	std::int64_t i;
+	const std::from_chars_result r = std::from_chars(at, end, i);
+	if (r.ec != std::errc())
+		return false;
+	at = r.ptr;
 
-		if (strcmp(lineHeader, "v") == 0) {
-			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
-			temp_vertices.push_back(vertex);
+	relative = i < 0;
+	i = relative ? std::int64_t(count) + i : i - 1;
+	if (i < (relative ? INT32_MIN : 0) || i > INT32_MAX)
+		return false;
+	index = std::int32_t(i);
+	return true;
+}
+
+// v, v/vt, v//vn or v/vt/vn
+static bool parseCorner(const char*& at, const char* end, ObjElements& e, ObjChunkCorner& c)
+{
+	const std::size_t counts[3] = {e.v.size(), e.vt.size(), e.vn.size()};
+	c.index[1] = -1;
+	c.index[2] = -1;
+	c.relative = 0;
+
+	for (int k = 0; k < 3; k++)
+	{
+		bool relative = false;
+		if (k > 0)
+		{
+			if (at == end || *at != '/')
+				return true;
+			at++;
+			// Empty vt of v//vn
+			if (k == 1 && (at == end || *at == '/' || IsBlank(*at)))
+				continue;
 		}
-		else if (strcmp(lineHeader, "vt") == 0) {
-			glm::vec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y);
-			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
+		if (!parseIndex(at, end, counts[k], c.index[k], relative))
+			return false;
+		c.relative |= std::uint8_t(relative) << k;
+		if (!relative)
+			e.ahead[k] = std::max(e.ahead[k], std::int64_t(c.index[k]) - std::int64_t(counts[k]));
+	}
+	return true;
+}
+
+// Appends the records of the lines of [at, end) to e; # starts a comment
+static bool parseLines(const char* at, const char* end, ObjElements& e)
+{
+	while (at < end)
+	{
+		const char* next = (const char*) std::memchr(at, '\n', std::size_t(end - at));
+		if (!next)
+			next = end;
+		// Records stop at a comment, which may follow them on the line
+		const char* eol = (const char*) std::memchr(at, '#', std::size_t(next - at));
+		if (!eol)
+			eol = next;
+
+		SkipBlanks(at, eol);
+		const char* keyword = at;
+		while (at < eol && !IsBlank(*at))
+			at++;
+		const std::size_t length = std::size_t(at - keyword);
+
+		if (length == 1 && keyword[0] == 'v')
+		{
+			glm::vec3 p;
+			if (!ParseFloat(at, eol, p.x) || !ParseFloat(at, eol, p.y) || !ParseFloat(at, eol, p.z))
+				return false;
+			e.v.push_back(p);
 		}
-		else if (strcmp(lineHeader, "vn") == 0) {
-			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
-			temp_normals.push_back(normal);
+		else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't')
+		{
+			// v is optional
+			glm::vec2 uv(0.f);
+			if (!ParseFloat(at, eol, uv.x))
+				return false;
+			ParseFloat(at, eol, uv.y);
+			e.vt.push_back(uv);
 		}
-		else if (strcmp(lineHeader, "f") == 0) {
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
-			if (matches != 9) {
-				printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-				fclose(file);
+		else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n')
+		{
+			glm::vec3 n;
+			if (!ParseFloat(at, eol, n.x) || !ParseFloat(at, eol, n.y) || !ParseFloat(at, eol, n.z))
 				return false;
+			e.vn.push_back(n);
+		}
+		else if (length == 1 && keyword[0] == 'f')
+		{
+			// Fan around the first corner
+			ObjChunkCorner first, previous, corner;
+			int count = 0;
+			for (SkipBlanks(at, eol); at < eol; SkipBlanks(at, eol))
+			{
+				if (!parseCorner(at, eol, e, corner) || (at < eol && !IsBlank(*at)))
+					return false;
+				if (count >= 2)
+				{
+					e.corners.push_back(first);
+					e.corners.push_back(previous);
+					e.corners.push_back(corner);
+				}
+				if (count == 0)
+					first = corner;
+				previous = corner;
+				count++;
 			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices.push_back(uvIndex[0]);
-			uvIndices.push_back(uvIndex[1]);
-			uvIndices.push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
 		}
-		else {
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
+
+		at = next + 1;
+	}
+	return true;
+}
+
+// Open addressing with linear probing over the distinct corners. Faces mostly
+// share their corners, so the table starts at a quarter of them and doubles
+// at half load.
+class CornerTable
+{
+public:
+	static constexpr std::uint32_t Empty = ~0u;
+
+	explicit CornerTable(std::size_t count)
+	{
+		std::size_t capacity = 16;
+		while (capacity < count)
+			capacity *= 2;
+		slots.assign(capacity, Empty);
+	}
+
+	// Index of the corner equal to c, or candidate after inserting it
+	std::uint32_t Insert(const ObjCorner& c, std::uint32_t candidate, const std::vector<ObjCorner>& corners)
+	{
+		std::uint32_t& slot = find(c, corners);
+		if (slot != Empty)
+			return slot;
+
+		slot = candidate;
+		if (2 * ++size > slots.size())
+		{
+			slots.assign(2 * slots.size(), Empty);
+			for (std::uint32_t k = 0; k <= candidate; k++)
+				find(corners[k], corners) = k;
 		}
+		return candidate;
+	}
 
+private:
+	std::uint32_t& find(const ObjCorner& c, const std::vector<ObjCorner>& corners)
+	{
+		const std::size_t mask = slots.size() - 1;
+		for (std::size_t s = HashTriple(std::uint32_t(c.v), std::uint32_t(c.vt), std::uint32_t(c.vn)) & mask;; s = (s + 1) & mask)
+		{
+			if (slots[s] == Empty || corners[slots[s]] == c)
+				return slots[s];
+		}
 	}
 
-	// For each vertex of each triangle
-	for (unsigned int i = 0; i < vertexIndices.size(); i++) {
+	std::vector<std::uint32_t> slots;
+	std::size_t size = 0;
+};
+
+// A run of whole lines of the file, parsed on its own
+struct ObjChunk
+{
+	const char* begin;
+	const char* end;
+	ObjElements e;
+	bool ok = false;
+
+	std::size_t first[3] = {}; // of the elements of the chunk in the file
+	std::size_t firstCorner = 0;
+
+	// Corners welded within the chunk, then within the file
+	std::vector<ObjCorner> distinct;
+	std::vector<std::uint32_t> local; // corner to distinct corner
+	std::vector<std::uint32_t> remap; // distinct corner to mesh vertex
+	bool uvs = false, normals = false;
+};
 
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
+// Start of the first line beginning at or after offset
+static const char* lineStart(const char* text, std::size_t size, std::size_t offset)
+{
+	if (offset == 0)
+		return text;
+	const char* eol = (const char*) std::memchr(text + offset - 1, '\n', size - offset + 1);
+	return eol ? eol + 1 : text + size;
+}
+
+// Runs fn over the chunks, one job each
+static void forEachChunk(std::vector<ObjChunk>& chunks, JobSystem* jobs, const std::function<void(ObjChunk&)>& fn)
+{
+	if (!jobs)
+	{
+		for (ObjChunk& c : chunks)
+			fn(c);
+		return;
+	}
+	jobs->ParallelFor(0, chunks.size(), 1, [&](std::size_t b, std::size_t e) {
+		for (std::size_t c = b; c < e; c++)
+			fn(chunks[c]);
+	});
+}
+
+// Makes the corners of the chunk absolute and welds them. False when one
+// refers to an element not read yet, as the sequential parse would find.
+static bool resolveCorners(ObjChunk& c)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		if (c.e.ahead[k] >= std::int64_t(c.first[k]))
+			return false;
+	}
 
-		// Get the attributes thanks to the index
-		glm::vec3 vertex = temp_vertices[vertexIndex - 1];
-		glm::vec2 uv = temp_uvs[uvIndex - 1];
-		glm::vec3 normal = temp_normals[normalIndex - 1];
+	const std::size_t n = c.e.corners.size();
+	c.distinct.reserve(n / 4);
+	c.local.resize(n);
+
+	CornerTable table(n / 2);
+	for (std::size_t i = 0; i < n; i++)
+	{
+		const ObjChunkCorner& raw = c.e.corners[i];
+		std::int64_t index[3];
+		for (int k = 0; k < 3; k++)
+		{
+			index[k] = raw.index[k];
+			if (raw.relative & (1 << k))
+				index[k] += std::int64_t(c.first[k]);
+			if (index[k] < 0 && raw.relative & (1 << k))
+				return false;
+		}
+
+		const ObjCorner corner = {std::int32_t(index[0]), std::int32_t(index[1]), std::int32_t(index[2])};
+		const std::uint32_t candidate = std::uint32_t(c.distinct.size());
+		c.distinct.push_back(corner);
+		c.local[i] = table.Insert(corner, candidate, c.distinct);
+		if (c.local[i] != candidate)
+			c.distinct.pop_back();
+		c.uvs |= corner.vt >= 0;
+		c.normals |= corner.vn >= 0;
+	}
+	return true;
+}
+
+bool ReadObj(const char* filename, ObjMesh& mesh, JobSystem* jobs)
+{
+	mesh = ObjMesh();
+
+	MappedFile file;
+	if (!file.Open(filename))
+		return false;
+
+	// Chunks start at the first line past their nominal offset, so neighbours
+	// agree on their bounds
+	const char* text = file.Data();
+	const std::size_t size = file.Size();
+	const std::size_t chunkBytes = std::size_t(1) << 20;
+	std::vector<ObjChunk> chunks((size + chunkBytes - 1) / chunkBytes);
+	for (std::size_t c = 0; c < chunks.size(); c++)
+	{
+		chunks[c].begin = lineStart(text, size, c * chunkBytes);
+		chunks[c].end = lineStart(text, size, std::min(size, (c + 1) * chunkBytes));
+	}
+
+	forEachChunk(chunks, jobs, [](ObjChunk& c) { c.ok = parseLines(c.begin, c.end, c.e); });
+
+	// Place of the elements and corners of every chunk in the file
+	std::size_t totals[3] = {}, corners = 0;
+	for (ObjChunk& c : chunks)
+	{
+		if (!c.ok)
+			return false;
+		const std::size_t counts[3] = {c.e.v.size(), c.e.vt.size(), c.e.vn.size()};
+		for (int k = 0; k < 3; k++)
+		{
+			c.first[k] = totals[k];
+			totals[k] += counts[k];
+		}
+		c.firstCorner = corners;
+		corners += c.e.corners.size();
+	}
+	if (std::max(std::max(totals[0], totals[1]), std::max(totals[2], corners)) > INT32_MAX)
+		return false;
+
+	std::vector<glm::vec3> v(totals[0]), vn(totals[2]);
+	std::vector<glm::vec2> vt(totals[1]);
+	std::atomic<bool> ok{true};
+	forEachChunk(chunks, jobs, [&](ObjChunk& c) {
+		std::copy(c.e.v.begin(), c.e.v.end(), v.begin() + c.first[0]);
+		std::copy(c.e.vt.begin(), c.e.vt.end(), vt.begin() + c.first[1]);
+		std::copy(c.e.vn.begin(), c.e.vn.end(), vn.begin() + c.first[2]);
+		if (!resolveCorners(c))
+			ok = false;
+	});
+	if (!ok)
+		return false;
+
+	// The corners shared by several chunks are merged in chunk order, so the
+	// vertices are in order of first use whatever the chunking
+	std::size_t unique = 0;
+	bool uvs = false, normals = false;
+	for (const ObjChunk& c : chunks)
+	{
+		unique += c.distinct.size();
+		uvs |= c.uvs;
+		normals |= c.normals;
+	}
+
+	std::vector<ObjCorner> distinct;
+	distinct.reserve(unique);
+	CornerTable table(unique / 2);
+	for (ObjChunk& c : chunks)
+	{
+		c.remap.resize(c.distinct.size());
+		for (std::size_t k = 0; k < c.distinct.size(); k++)
+		{
+			const std::uint32_t candidate = std::uint32_t(distinct.size());
+			distinct.push_back(c.distinct[k]);
+			c.remap[k] = table.Insert(c.distinct[k], candidate, distinct);
+			if (c.remap[k] != candidate)
+				distinct.pop_back();
+		}
+	}
+
+	mesh.indices.resize(corners);
+	forEachChunk(chunks, jobs, [&mesh](ObjChunk& c) {
+		for (std::size_t i = 0; i < c.local.size(); i++)
+			mesh.indices[c.firstCorner + i] = c.remap[c.local[i]];
+	});
+
+	const std::size_t count = distinct.size();
+	mesh.positions.resize(count);
+	mesh.uvs.assign(uvs ? count : 0, glm::vec2(0.f));
+	mesh.normals.assign(normals ? count : 0, glm::vec3(0.f));
+	auto gather = [&](std::size_t b, std::size_t e) {
+		for (std::size_t k = b; k < e; k++)
+		{
+			const ObjCorner& c = distinct[k];
+			mesh.positions[k] = v[c.v];
+			if (uvs && c.vt >= 0)
+				mesh.uvs[k] = vt[c.vt];
+			if (normals && c.vn >= 0)
+				mesh.normals[k] = vn[c.vn];
+		}
+	};
+	if (jobs)
+		jobs->ParallelFor(0, count, 0, gather);
+	else
+		gather(0, count);
+	return true;
+}
+
+bool loadOBJ(
+	const char* path,
+	std::vector<glm::vec3>& out_vertices,
+	std::vector<glm::vec2>& out_uvs,
+	std::vector<glm::vec3>& out_normals,
+	JobSystem* jobs
+) {
+	printf("Loading OBJ file %s...\n", path);
+
+	ObjMesh mesh;
+	if (!ReadObj(path, mesh, jobs))
+	{
+		printf("Impossible to read the OBJ file %s\n", path);
+		return false;
+	}
 
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_uvs.push_back(uv);
-		out_normals.push_back(normal);
+	out_vertices.reserve(out_vertices.size() + mesh.indices.size());
+	out_uvs.reserve(out_uvs.size() + mesh.indices.size());
+	out_normals.reserve(out_normals.size() + mesh.indices.size());
 
+	// Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+	for (std::uint32_t i : mesh.indices)
+	{
+		out_vertices.push_back(mesh.positions[i]);
+		out_uvs.push_back(mesh.uvs.empty() ? glm::vec2(0.f) : glm::vec2(mesh.uvs[i].x, -mesh.uvs[i].y));
+		out_normals.push_back(mesh.normals.empty() ? glm::vec3(0.f) : mesh.normals[i]);
 	}
-	fclose(file);
 	return true;
-}
\ No newline at end of file
+}
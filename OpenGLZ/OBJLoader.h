@@ -1,18 +1,41 @@
 #ifndef OBJLOADER_H
 #define OBJLOADER_H
 
+#include <cstdint>
 #include <vector>
-#include <stdio.h>
-#include <string>
-#include <cstring>
 
 #include <glm/glm.hpp>
 
+class JobSystem;
+
+// Indexed mesh of an OBJ file: every distinct position/uv/normal triple used
+// by the faces is one vertex. uvs and normals are empty when no face uses
+// them, and zero for the vertices of the faces without them.
+struct ObjMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<std::uint32_t> indices; // three per triangle
+};
+
+// Reads the v, vt, vn and f records of a mapped OBJ file; other records and
+// comments, which may end a record line, are ignored. Faces take the forms v, v/vt, v//vn and v/vt/vn, negative indices
+// count back from the last element read, and polygons are split in fans of
+// triangles. False when the file cannot be read, a record is malformed or a
+// face refers to a missing element.
+// The file is cut in chunks of whole lines, parsed in parallel with jobs into
+// their own arrays; a prefix sum over the element counts of the chunks then
+// places them in the file and makes their face indices absolute.
+bool ReadObj(const char* filename, ObjMesh& mesh, JobSystem* jobs = nullptr);
+
+// Unindexed triangles of an OBJ file, with the v coordinate of uvs flipped
 bool loadOBJ(
 	const char* path,
 	std::vector<glm::vec3>& out_vertices,
 	std::vector<glm::vec2>& out_uvs,
-	std::vector<glm::vec3>& out_normals
+	std::vector<glm::vec3>& out_normals,
+	JobSystem* jobs = nullptr
 );
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,257 @@
+#include "bvh.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static float halfArea(const glm::vec3& min, const glm::vec3& max)
+{
+	const glm::vec3 e = max - min;
+	return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+void Bvh::Build(const std::vector<Triangle>& triangles)
+{
+	nodes.clear();
+	p0.clear();
+	e1.clear();
+	e2.clear();
+
+	const std::uint32_t n = std::uint32_t(triangles.size());
+	if (n == 0)
+		return;
+
+	std::vector<BuildTriangle> tris(n);
+	for (std::uint32_t i = 0; i < n; i++)
+	{
+		const Triangle& t = triangles[i];
+		tris[i].min = glm::min(t.p0, glm::min(t.p1, t.p2));
+		tris[i].max = glm::max(t.p0, glm::max(t.p1, t.p2));
+		tris[i].centroid = (t.p0 + t.p1 + t.p2) / 3.f;
+		tris[i].index = i;
+	}
+
+	// A binary tree with at least one triangle per leaf, so the nodes never move
+	nodes.reserve(2 * std::size_t(n));
+	nodes.push_back({});
+	buildNode(tris, 0, 0, n, 0);
+
+	p0.resize(n);
+	e1.resize(n);
+	e2.resize(n);
+	for (std::uint32_t i = 0; i < n; i++)
+	{
+		const Triangle& t = triangles[tris[i].index];
+		p0[i] = t.p0;
+		e1[i] = t.p1 - t.p0;
+		e2[i] = t.p2 - t.p0;
+	}
+}
+
+void Bvh::buildNode(std::vector<BuildTriangle>& tris, std::uint32_t index, std::uint32_t first, std::uint32_t count, unsigned depth)
+{
+	glm::vec3 min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max());
+	glm::vec3 cmin = min, cmax = max;
+	for (std::uint32_t i = first; i < first + count; i++)
+	{
+		min = glm::min(min, tris[i].min);
+		max = glm::max(max, tris[i].max);
+		cmin = glm::min(cmin, tris[i].centroid);
+		cmax = glm::max(cmax, tris[i].centroid);
+	}
+
+	nodes[index].min = min;
+	nodes[index].max = max;
+	nodes[index].first = first;
+	nodes[index].count = count;
+
+	if (count <= leafSize || depth + 1 >= MaxDepth)
+		return;
+
+	// Binned SAH: cost of a split is the area-weighted triangle count of both sides
+	struct Bin
+	{
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+		std::uint32_t count = 0;
+	};
+	std::vector<Bin> binned(bins);
+	std::vector<float> rightCost(bins);
+
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	unsigned bestBin = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = cmax[axis] - cmin[axis];
+		if (!(extent > 0.f))
+			continue;
+		const float scale = bins / extent;
+
+		std::fill(binned.begin(), binned.end(), Bin());
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			const unsigned b = std::min(bins - 1, unsigned((tris[i].centroid[axis] - cmin[axis]) * scale));
+			binned[b].min = glm::min(binned[b].min, tris[i].min);
+			binned[b].max = glm::max(binned[b].max, tris[i].max);
+			binned[b].count++;
+		}
+
+		// Right side of every split plane, swept from the end
+		Bin right;
+		for (unsigned b = bins - 1; b > 0; b--)
+		{
+			right.min = glm::min(right.min, binned[b].min);
+			right.max = glm::max(right.max, binned[b].max);
+			right.count += binned[b].count;
+			rightCost[b] = right.count ? right.count * halfArea(right.min, right.max) : 0.f;
+		}
+
+		Bin left;
+		for (unsigned b = 0; b + 1 < bins; b++)
+		{
+			left.min = glm::min(left.min, binned[b].min);
+			left.max = glm::max(left.max, binned[b].max);
+			left.count += binned[b].count;
+
+			const float cost = (left.count ? left.count * halfArea(left.min, left.max) : 0.f) + rightCost[b + 1];
+			if (left.count && left.count < count && cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	// A leaf costs one test per triangle, an inner node one box test plus its children
+	const float nodeArea = halfArea(min, max);
+	if (bestAxis < 0 || (nodeArea > 0.f && 1.f + bestCost / nodeArea >= float(count) && count <= 4 * leafSize))
+		return;
+
+	const float scale = bins / (cmax[bestAxis] - cmin[bestAxis]);
+	const auto middle = std::partition(tris.begin() + first, tris.begin() + first + count, [&](const BuildTriangle& t) {
+		return std::min(bins - 1, unsigned((t.centroid[bestAxis] - cmin[bestAxis]) * scale)) <= bestBin;
+	});
+	const std::uint32_t leftCount = std::uint32_t(middle - (tris.begin() + first));
+
+	const std::uint32_t left = std::uint32_t(nodes.size());
+	nodes.push_back({});
+	nodes.push_back({});
+	nodes[index].first = left;
+	nodes[index].count = 0;
+
+	buildNode(tris, left, first, leftCount, depth + 1);
+	buildNode(tris, left + 1, first + leftCount, count - leftCount, depth + 1);
+}
+
+// Entry fraction of the segment into the box, or infinity when it misses before tMax
+static inline float slab(const BvhNode& node, const glm::vec3& a, const glm::vec3& inv, float tMax)
+{
+	const glm::vec3 t0 = (node.min - a) * inv;
+	const glm::vec3 t1 = (node.max - a) * inv;
+	const glm::vec3 tn = glm::min(t0, t1);
+	const glm::vec3 tf = glm::max(t0, t1);
+
+	const float enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, 0.f));
+	const float exit = std::min(std::min(tf.x, tf.y), std::min(tf.z, tMax));
+	return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+}
+
+bool Bvh::Intersect(const glm::vec3& a, const glm::vec3& b, SegmentHit& hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	const glm::vec3 d = b - a;
+	const glm::vec3 inv = 1.f / d;
+	const float inf = std::numeric_limits<float>::infinity();
+
+	float tMax = 1.f;
+	std::uint32_t best = ~0u;
+
+	if (slab(nodes[0], a, inv, tMax) == inf)
+		return false;
+
+	std::uint32_t stack[MaxDepth];
+	unsigned top = 0;
+	std::uint32_t current = 0;
+
+	for (;;)
+	{
+		const BvhNode& node = nodes[current];
+		if (node.count)
+		{
+			// Möller-Trumbore, with t as a fraction of the segment
+			for (std::uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				const glm::vec3 pv = glm::cross(d, e2[i]);
+				const float det = glm::dot(e1[i], pv);
+				if (det == 0.f)
+					continue;
+				const float invDet = 1.f / det;
+
+				const glm::vec3 tv = a - p0[i];
+				const float u = glm::dot(tv, pv) * invDet;
+				if (u < 0.f || u > 1.f)
+					continue;
+
+				const glm::vec3 qv = glm::cross(tv, e1[i]);
+				const float v = glm::dot(d, qv) * invDet;
+				if (v < 0.f || u + v > 1.f)
+					continue;
+
+				const float t = glm::dot(e2[i], qv) * invDet;
+				if (t >= 0.f && t < tMax)
+				{
+					tMax = t;
+					best = i;
+				}
+			}
+		}
+		else
+		{
+			// Nearest child first, the other one waits on the stack
+			std::uint32_t near = node.first, far = node.first + 1;
+			float tNear = slab(nodes[near], a, inv, tMax);
+			float tFar = slab(nodes[far], a, inv, tMax);
+			if (tFar < tNear)
+			{
+				std::swap(near, far);
+				std::swap(tNear, tFar);
+			}
+
+			if (tNear != inf)
+			{
+				if (tFar != inf)
+					stack[top++] = far;
+				current = near;
+				continue;
+			}
+		}
+
+		// Pop, skipping the nodes now behind the nearest hit
+		for (;;)
+		{
+			if (top == 0)
+			{
+				if (best == ~0u)
+					return false;
+
+				glm::vec3 n = glm::normalize(glm::cross(e1[best], e2[best]));
+				if (glm::dot(n, d) > 0.f)
+					n = -n;
+				hit.t = tMax;
+				hit.normal = n;
+				return true;
+			}
+
+			current = stack[--top];
+			if (slab(nodes[current], a, inv, tMax) != inf)
+				break;
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "stl.h"
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct BvhNode
+{
+	glm::vec3 min;
+	std::uint32_t first; // first triangle of a leaf, left child of an inner node (right is first + 1)
+	glm::vec3 max;
+	std::uint32_t count; // triangles of a leaf, 0 for an inner node
+};
+
+struct SegmentHit
+{
+	float t; // fraction of the segment
+	glm::vec3 normal; // unit face normal, facing the start of the segment
+};
+
+// Bounding volume hierarchy over a triangle soup, split by the surface area
+// heuristic evaluated on bins of the centroids. Nodes are 32 bytes with
+// sibling pairs adjacent; triangles are reordered to match the leaves and
+// stored as vertex and edges for the segment tests.
+class Bvh
+{
+public:
+	unsigned leafSize = 4; // a node this small is never split
+	unsigned bins = 12;
+
+	void Build(const std::vector<Triangle>& triangles);
+
+	bool Empty() const { return nodes.empty(); }
+
+	// Nearest intersection of the segment [a, b] with the mesh
+	bool Intersect(const glm::vec3& a, const glm::vec3& b, SegmentHit& hit) const;
+
+	const std::vector<BvhNode>& Nodes() const { return nodes; }
+	std::size_t TriangleCount() const { return p0.size(); }
+
+private:
+	struct BuildTriangle
+	{
+		glm::vec3 min, max, centroid;
+		std::uint32_t index;
+	};
+
+	// Depth of the traversal stack, leaves are forced below it
+	static constexpr unsigned MaxDepth = 64;
+
+	void buildNode(std::vector<BuildTriangle>& tris, std::uint32_t index, std::uint32_t first, std::uint32_t count, unsigned depth);
+
+	std::vector<BvhNode> nodes;
+	std::vector<glm::vec3> p0, e1, e2;
+};
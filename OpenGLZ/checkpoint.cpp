@@ -0,0 +1,313 @@
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static std::size_t alignUp(std::size_t n)
+{
+	return (n + CheckpointAlignment - 1) / CheckpointAlignment * CheckpointAlignment;
+}
+
+// Scalar arrays of the store by field, nullptr for color
+template<typename Store>
+static auto scalarField(Store& p, CheckpointField field) -> decltype(&p.px)
+{
+	switch (field)
+	{
+	case CheckpointField::PositionX: return &p.px;
+	case CheckpointField::PositionY: return &p.py;
+	case CheckpointField::PositionZ: return &p.pz;
+	case CheckpointField::VelocityX: return &p.vx;
+	case CheckpointField::VelocityY: return &p.vy;
+	case CheckpointField::VelocityZ: return &p.vz;
+	case CheckpointField::Mass: return &p.mass;
+	case CheckpointField::Life: return &p.life;
+	default: return nullptr;
+	}
+}
+
+static std::size_t elementBytes(CheckpointEncoding encoding)
+{
+	switch (encoding)
+	{
+	case CheckpointEncoding::Unorm16: return 2;
+	case CheckpointEncoding::Float32x4: return 16;
+	default: return 4;
+	}
+}
+
+void EncodeCheckpoint(const ParticleStore& p, std::uint64_t step, double time, bool quantize,
+	JobSystem& jobs, std::vector<char>& out)
+{
+	const std::size_t n = p.Size();
+	const std::uint32_t chunkCount = std::uint32_t(CheckpointField::Count);
+
+	// Life stays in floats: immortal particles live forever
+	CheckpointChunk chunks[std::size_t(CheckpointField::Count)];
+	std::size_t offset = alignUp(sizeof(CheckpointFrame) + chunkCount * sizeof(CheckpointChunk));
+	for (std::uint32_t f = 0; f < chunkCount; f++)
+	{
+		const auto field = CheckpointField(f);
+		CheckpointChunk& c = chunks[f];
+		c.field = field;
+		if (field == CheckpointField::Color)
+			c.encoding = quantize ? CheckpointEncoding::Unorm8x4 : CheckpointEncoding::Float32x4;
+		else if (field == CheckpointField::Life)
+			c.encoding = CheckpointEncoding::Float32;
+		else
+			c.encoding = quantize ? CheckpointEncoding::Unorm16 : CheckpointEncoding::Float32;
+		c.offset = offset;
+		c.bytes = n * elementBytes(c.encoding);
+		c.min = 0.f;
+		c.max = 0.f;
+		offset += alignUp(std::size_t(c.bytes));
+	}
+
+	out.resize(offset);
+	char* frameStart = out.data();
+	std::memset(frameStart, 0, std::size_t(chunks[0].offset));
+
+	// One job per field: find its range if quantized, then convert
+	jobs.ParallelFor(0, chunkCount, 1, [&](std::size_t b, std::size_t e) {
+		for (std::size_t f = b; f < e; f++)
+		{
+			CheckpointChunk& c = chunks[f];
+			char* data = frameStart + c.offset;
+			const std::size_t padded = alignUp(std::size_t(c.bytes));
+			std::memset(data + c.bytes, 0, padded - std::size_t(c.bytes));
+
+			const AlignedArray<float>* source = scalarField(p, c.field);
+			switch (c.encoding)
+			{
+			case CheckpointEncoding::Float32:
+				std::memcpy(data, source->data(), std::size_t(c.bytes));
+				break;
+			case CheckpointEncoding::Float32x4:
+				std::memcpy(data, p.color.data(), std::size_t(c.bytes));
+				break;
+			case CheckpointEncoding::Unorm16:
+			{
+				const float* x = source->data();
+				float lo = n ? x[0] : 0.f, hi = lo;
+				for (std::size_t i = 0; i < n; i++)
+				{
+					lo = std::min(lo, x[i]);
+					hi = std::max(hi, x[i]);
+				}
+				c.min = lo;
+				c.max = hi;
+
+				const float scale = hi > lo ? 65535.f / (hi - lo) : 0.f;
+				auto q = (std::uint16_t*) data;
+				for (std::size_t i = 0; i < n; i++)
+					q[i] = std::uint16_t((x[i] - lo) * scale + 0.5f);
+				break;
+			}
+			case CheckpointEncoding::Unorm8x4:
+			{
+				auto q = (std::uint8_t*) data;
+				for (std::size_t i = 0; i < n; i++)
+				{
+					for (int k = 0; k < 4; k++)
+						q[4 * i + k] = std::uint8_t(std::min(std::max(p.color[i][k], 0.f), 1.f) * 255.f + 0.5f);
+				}
+				break;
+			}
+			}
+		}
+	});
+
+	CheckpointFrame frame = {};
+	std::memcpy(frame.magic, "GLZF", 4);
+	frame.chunkCount = chunkCount;
+	frame.bytes = offset;
+	frame.step = step;
+	frame.time = time;
+	frame.count = n;
+	std::memcpy(frameStart, &frame, sizeof(frame));
+	std::memcpy(frameStart + sizeof(frame), chunks, sizeof(chunks));
+}
+
+/* RECORDER */
+
+bool CheckpointRecorder::Open(const char* filename)
+{
+	Close();
+
+	file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	CheckpointHeader header = {};
+	std::memcpy(header.magic, "GLZCKPT", 8);
+	header.version = CheckpointVersion;
+	file.write((const char*) &header, sizeof(header));
+
+	frames = 0;
+	waits = 0;
+	bytes = sizeof(header);
+	failed = !file;
+	closing = false;
+	filling = 0;
+	thread = std::thread(&CheckpointRecorder::writer, this);
+	return true;
+}
+
+void CheckpointRecorder::Record(const ParticleStore& p, std::uint64_t step, double time, JobSystem& jobs)
+{
+	if (!IsOpen())
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (busy[filling])
+		{
+			waits++;
+			changed.wait(lock, [this] { return !busy[filling]; });
+		}
+	}
+
+	EncodeCheckpoint(p, step, time, quantize, jobs, buffers[filling]);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		busy[filling] = true;
+		queue.push_back(filling);
+	}
+	changed.notify_all();
+	filling = 1 - filling;
+}
+
+void CheckpointRecorder::Close()
+{
+	if (!IsOpen())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closing = true;
+	}
+	changed.notify_all();
+	thread.join();
+	file.close();
+}
+
+void CheckpointRecorder::writer()
+{
+	for (;;)
+	{
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this] { return !queue.empty() || closing; });
+			if (queue.empty())
+				return;
+			index = queue.front();
+		}
+
+		const std::vector<char>& buffer = buffers[index];
+		file.write(buffer.data(), std::streamsize(buffer.size()));
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.pop_front();
+			busy[index] = false;
+			failed = failed || !file;
+			frames++;
+			bytes += buffer.size();
+		}
+		changed.notify_all();
+	}
+}
+
+/* READER */
+
+bool CheckpointReader::Open(const char* filename)
+{
+	frames.clear();
+	if (!file.Open(filename) || file.Size() < sizeof(CheckpointHeader))
+		return false;
+
+	const auto header = (const CheckpointHeader*) file.Data();
+	if (std::memcmp(header->magic, "GLZCKPT", 8) != 0 || header->version != CheckpointVersion)
+		return false;
+
+	// A frame cut short (the recorder was killed mid-write) ends the file
+	std::size_t offset = sizeof(CheckpointHeader);
+	while (offset + sizeof(CheckpointFrame) <= file.Size())
+	{
+		const auto frame = (const CheckpointFrame*) (file.Data() + offset);
+		const std::size_t tableEnd = sizeof(CheckpointFrame) + frame->chunkCount * sizeof(CheckpointChunk);
+		if (std::memcmp(frame->magic, "GLZF", 4) != 0 || frame->bytes < tableEnd || frame->bytes > file.Size() - offset)
+			break;
+
+		frames.push_back(frame);
+		offset += std::size_t(frame->bytes);
+	}
+	return true;
+}
+
+const CheckpointChunk* CheckpointReader::Chunk(std::size_t i, CheckpointField field) const
+{
+	const CheckpointFrame* frame = frames[i];
+	const auto chunks = (const CheckpointChunk*) (frame + 1);
+	for (std::uint32_t c = 0; c < frame->chunkCount; c++)
+	{
+		const std::size_t need = std::size_t(frame->count) * elementBytes(chunks[c].encoding);
+		if (chunks[c].field == field && chunks[c].bytes >= need && chunks[c].offset + chunks[c].bytes <= frame->bytes)
+			return &chunks[c];
+	}
+	return nullptr;
+}
+
+const void* CheckpointReader::Data(std::size_t i, const CheckpointChunk& chunk) const
+{
+	return (const char*) frames[i] + chunk.offset;
+}
+
+bool CheckpointReader::Load(std::size_t i, ParticleStore& p, JobSystem& jobs) const
+{
+	const std::size_t n = std::size_t(frames[i]->count);
+	if (n > p.Capacity())
+		return false;
+
+	p.Clear();
+	p.Spawn(n);
+
+	const std::size_t fieldCount = std::size_t(CheckpointField::Count);
+	jobs.ParallelFor(0, fieldCount, 1, [&](std::size_t b, std::size_t e) {
+		for (std::size_t f = b; f < e; f++)
+		{
+			const CheckpointChunk* c = Chunk(i, CheckpointField(f));
+			if (!c)
+				continue;
+
+			const void* data = Data(i, *c);
+			AlignedArray<float>* target = scalarField(p, c->field);
+			if (c->field == CheckpointField::Color)
+			{
+				if (c->encoding == CheckpointEncoding::Float32x4)
+					std::memcpy(p.color.data(), data, n * sizeof(glm::vec4));
+				else if (c->encoding == CheckpointEncoding::Unorm8x4)
+				{
+					auto q = (const std::uint8_t*) data;
+					for (std::size_t k = 0; k < n; k++)
+						p.color[k] = glm::vec4(q[4 * k], q[4 * k + 1], q[4 * k + 2], q[4 * k + 3]) / 255.f;
+				}
+			}
+			else if (c->encoding == CheckpointEncoding::Float32)
+				std::memcpy(target->data(), data, n * sizeof(float));
+			else if (c->encoding == CheckpointEncoding::Unorm16)
+			{
+				auto q = (const std::uint16_t*) data;
+				const float scale = (c->max - c->min) / 65535.f;
+				for (std::size_t k = 0; k < n; k++)
+					(*target)[k] = c->min + q[k] * scale;
+			}
+		}
+	});
+
+	jobs.ParallelFor(0, n, 0, [&p](std::size_t b, std::size_t e) { p.SavePositions(b, e - b); });
+	return true;
+}
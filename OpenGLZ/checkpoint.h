@@ -0,0 +1,152 @@
+#pragma once
+
+#include "jobs.h"
+#include "mapped.h"
+#include "particles.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* CHECKPOINTS
+ * A file is a CheckpointHeader followed by frames. A frame is a
+ * CheckpointFrame, its chunk table, then one chunk of data per field.
+ * Every offset and size is a multiple of CheckpointAlignment, so in a mapped
+ * file the chunks are aligned arrays that can be used in place.
+ * Values are little-endian.
+ */
+
+constexpr std::uint32_t CheckpointVersion = 1;
+constexpr std::size_t CheckpointAlignment = 64;
+
+enum class CheckpointField : std::uint32_t
+{
+	PositionX, PositionY, PositionZ,
+	VelocityX, VelocityY, VelocityZ,
+	Mass,
+	Life,
+	Color,
+	Count
+};
+
+enum class CheckpointEncoding : std::uint32_t
+{
+	Float32, // raw floats
+	Unorm16, // uint16 over [min, max] of the chunk
+	Float32x4, // raw vec4
+	Unorm8x4 // RGBA8 over [0, 1]
+};
+
+struct CheckpointHeader
+{
+	char magic[8]; // "GLZCKPT"
+	std::uint32_t version;
+	std::uint32_t flags;
+	char reserved[48];
+};
+
+struct CheckpointChunk
+{
+	CheckpointField field;
+	CheckpointEncoding encoding;
+	std::uint64_t offset; // from the start of the frame
+	std::uint64_t bytes;
+	float min, max; // range of Unorm16 chunks
+};
+
+struct CheckpointFrame
+{
+	char magic[4]; // "GLZF"
+	std::uint32_t chunkCount;
+	std::uint64_t bytes; // whole frame, to the next one
+	std::uint64_t step;
+	double time;
+	std::uint64_t count; // particles
+	char reserved[24];
+	// chunkCount CheckpointChunk follow
+};
+
+static_assert(sizeof(CheckpointHeader) == CheckpointAlignment, "header must keep frames aligned");
+static_assert(sizeof(CheckpointFrame) == CheckpointAlignment, "frame header must keep chunks aligned");
+static_assert(sizeof(CheckpointChunk) == 32, "chunk table entries are packed");
+
+// Lays a frame of the particles out into out, ready to be written. With
+// quantize, positions, speeds and masses take 16 bits and colors 8 bits per channel.
+void EncodeCheckpoint(const ParticleStore& p, std::uint64_t step, double time, bool quantize,
+	JobSystem& jobs, std::vector<char>& out);
+
+// Streams frames to a file. Record encodes on the calling thread into one of
+// two buffers while a background thread writes the other one, so a frame only
+// waits on the disk when the previous one is still being written.
+class CheckpointRecorder
+{
+public:
+	bool quantize = false;
+
+	CheckpointRecorder() = default;
+	~CheckpointRecorder() { Close(); }
+
+	CheckpointRecorder(const CheckpointRecorder&) = delete;
+	CheckpointRecorder& operator=(const CheckpointRecorder&) = delete;
+
+	bool Open(const char* filename);
+	bool IsOpen() const { return thread.joinable(); }
+
+	void Record(const ParticleStore& p, std::uint64_t step, double time, JobSystem& jobs);
+
+	// Writes the pending frames and closes the file
+	void Close();
+
+	std::size_t Frames() const { return frames; }
+	std::uint64_t Bytes() const { return bytes; }
+	std::size_t Waits() const { return waits; } // Record calls that waited for the writer
+	bool Failed() const { return failed; }
+
+private:
+	void writer();
+
+	std::ofstream file;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable changed;
+
+	std::vector<char> buffers[2];
+	bool busy[2] = {};
+	std::deque<int> queue; // buffers to write, in order
+	int filling = 0;
+	bool closing = false;
+
+	// Updated by the writer thread
+	std::atomic<std::size_t> frames{0};
+	std::atomic<std::uint64_t> bytes{0};
+	std::atomic<bool> failed{false};
+	std::size_t waits = 0;
+};
+
+// Frames of a mapped checkpoint file. Open only walks the frame headers;
+// the data is read in place.
+class CheckpointReader
+{
+public:
+	bool Open(const char* filename);
+
+	std::size_t FrameCount() const { return frames.size(); }
+	const CheckpointFrame& Frame(std::size_t i) const { return *frames[i]; }
+
+	// Chunk of a field in frame i, nullptr when the frame has none
+	const CheckpointChunk* Chunk(std::size_t i, CheckpointField field) const;
+	// Data of a chunk, in its encoding
+	const void* Data(std::size_t i, const CheckpointChunk& chunk) const;
+
+	// Replaces the particles of p by those of frame i. False when they do not fit.
+	bool Load(std::size_t i, ParticleStore& p, JobSystem& jobs) const;
+
+private:
+	MappedFile file;
+	std::vector<const CheckpointFrame*> frames;
+};
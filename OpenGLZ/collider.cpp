@@ -0,0 +1,120 @@
+#include "collider.h"
+
+#include <glm/geometric.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+void MeshCollider::Build(const std::vector<Triangle>& triangles, const glm::mat4& transform)
+{
+	std::vector<Triangle> moved(triangles.size());
+	for (std::size_t i = 0; i < triangles.size(); i++)
+	{
+		moved[i].p0 = glm::vec3(transform * glm::vec4(triangles[i].p0, 1.f));
+		moved[i].p1 = glm::vec3(transform * glm::vec4(triangles[i].p1, 1.f));
+		moved[i].p2 = glm::vec3(transform * glm::vec4(triangles[i].p2, 1.f));
+	}
+	bvh.Build(moved);
+}
+
+std::size_t MeshCollider::Collide(ParticleStore& p, std::size_t count, std::size_t chunk, JobSystem& jobs, std::uint8_t* hits)
+{
+	if (bvh.Empty())
+	{
+		if (hits)
+			std::fill(hits, hits + count, std::uint8_t(0));
+		return 0;
+	}
+
+	const BvhNode& root = bvh.Nodes()[0];
+	std::atomic<std::size_t> contacts{0};
+
+	jobs.ParallelFor(0, count, chunk, [&](std::size_t b, std::size_t e) {
+		if (hits)
+			std::fill(hits + b, hits + e, std::uint8_t(0));
+
+		// Batches of candidates: a first pass keeps the particles whose segment
+		// overlaps the mesh bounds, the traversals then run back to back
+		constexpr std::size_t Batch = 256;
+		std::uint32_t candidates[Batch];
+		std::size_t found = 0;
+
+		for (std::size_t first = b; first < e; first += Batch)
+		{
+			const std::size_t last = std::min(e, first + Batch);
+			std::size_t n = 0;
+			for (std::size_t i = first; i < last; i++)
+			{
+				const float x0 = p.prevX[i], y0 = p.prevY[i], z0 = p.prevZ[i];
+				const float x1 = p.px[i], y1 = p.py[i], z1 = p.pz[i];
+
+				// A particle that wrapped around the domain did not travel in between
+				const bool wrapped = std::fabs(x1 - x0) > 1.f || std::fabs(y1 - y0) > 1.f || std::fabs(z1 - z0) > 1.f;
+				const bool outside =
+					std::max(x0, x1) < root.min.x || std::min(x0, x1) > root.max.x ||
+					std::max(y0, y1) < root.min.y || std::min(y0, y1) > root.max.y ||
+					std::max(z0, z1) < root.min.z || std::min(z0, z1) > root.max.z;
+				candidates[n] = std::uint32_t(i);
+				n += !(wrapped || outside);
+			}
+
+			for (std::size_t c = 0; c < n; c++)
+			{
+				const std::uint32_t i = candidates[c];
+				const glm::vec3 a(p.prevX[i], p.prevY[i], p.prevZ[i]);
+				const glm::vec3 d = glm::vec3(p.px[i], p.py[i], p.pz[i]) - a;
+
+				SegmentHit hit;
+				if (!bvh.Intersect(a, a + d, hit))
+					continue;
+
+				const glm::vec3 contact = a + d * hit.t + hit.normal * offset;
+				p.px[i] = contact.x;
+				p.py[i] = contact.y;
+				p.pz[i] = contact.z;
+
+				// Reflect the normal part of the speed, damp the tangential part
+				const glm::vec3 v(p.vx[i], p.vy[i], p.vz[i]);
+				const float vn = glm::dot(v, hit.normal);
+				if (vn < 0.f)
+				{
+					const glm::vec3 tangent = v - vn * hit.normal;
+					const glm::vec3 out = tangent * (1.f - friction) - vn * restitution * hit.normal;
+					p.vx[i] = out.x;
+					p.vy[i] = out.y;
+					p.vz[i] = out.z;
+				}
+				if (hits)
+					hits[i] = 1;
+				found++;
+			}
+		}
+
+		contacts += found;
+	});
+
+	return contacts;
+}
+
+glm::mat4 LayMeshFlat(const std::vector<Triangle>& triangles, float size, float y)
+{
+	if (triangles.empty())
+		return glm::mat4(1.f);
+
+	glm::vec3 min = triangles[0].p0, max = min;
+	for (const auto& t : triangles)
+	{
+		min = glm::min(min, glm::min(t.p0, glm::min(t.p1, t.p2)));
+		max = glm::max(max, glm::max(t.p0, glm::max(t.p1, t.p2)));
+	}
+	const glm::vec3 extent = max - min;
+	const float largest = std::max(extent.x, std::max(extent.y, extent.z));
+
+	return glm::translate(glm::vec3(0.f, y, 0.f))
+		* glm::rotate(-1.57079632679f, glm::vec3(1.f, 0.f, 0.f))
+		* glm::scale(glm::vec3(size / largest))
+		* glm::translate(-(min + max) * 0.5f);
+}
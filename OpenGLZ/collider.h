@@ -0,0 +1,40 @@
+#pragma once
+
+#include "bvh.h"
+#include "jobs.h"
+#include "particles.h"
+
+#include <glm/mat4x4.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Particles against a static triangle mesh. Every step, the segment from a
+// particle's previous position (prevX/Y/Z) to its current one is tested against
+// the mesh; a particle crossing it is put back at the contact point and bounces.
+class MeshCollider
+{
+public:
+	float restitution = 0.3f; // fraction of the normal speed kept by a bounce
+	float friction = 0.1f; // fraction of the tangential speed lost on contact
+	float offset = 1e-4f; // distance kept from the surface after a contact
+
+	// Builds the hierarchy over the triangles moved by transform
+	void Build(const std::vector<Triangle>& triangles, const glm::mat4& transform = glm::mat4(1.f));
+	bool Empty() const { return bvh.Empty(); }
+
+	// Resolves the contacts of the step that moved particles [0, count) from
+	// their previous position. Returns the number of contacts. With hits, sets
+	// hits[i] to 1 for the particles that touched the mesh and 0 for the others.
+	std::size_t Collide(ParticleStore& p, std::size_t count, std::size_t chunk, JobSystem& jobs, std::uint8_t* hits = nullptr);
+
+	const Bvh& Tree() const { return bvh; }
+
+private:
+	Bvh bvh;
+};
+
+// Transform laying a mesh flat (its z axis turned up) at the center of the
+// particle cube, scaled so that its largest side spans size, at height y
+glm::mat4 LayMeshFlat(const std::vector<Triangle>& triangles, float size, float y);
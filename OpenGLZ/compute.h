@@ -0,0 +1,48 @@
+#pragma once
+
+#include "particles.h"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Particle step on the GPU: shader.comp runs over an SSBO in the Particule
+// layout, which the display VAO reads directly as its vertex buffer.
+// Only the uniform gravity step is implemented on this backend.
+class GpuParticles
+{
+public:
+	GpuParticles() = default;
+	~GpuParticles();
+
+	GpuParticles(const GpuParticles&) = delete;
+	GpuParticles& operator=(const GpuParticles&) = delete;
+
+	void Create(GLuint program, std::size_t capacity);
+	GLuint Buffer() const { return buffer; }
+
+	// Copies the store to the SSBO and back
+	void Upload(const ParticleStore& p);
+	void Download(ParticleStore& p) const;
+	// Copies the first n particles of the SSBO as they are
+	void Read(Particule* out, std::size_t n) const;
+
+	// One step of the first n particles, rounding the group count up
+	void Step(std::size_t n, float dt) const;
+
+private:
+	GLuint program = 0;
+	GLuint buffer = 0;
+	std::size_t capacity = 0;
+	GLint uniformDt = -1, uniformGravity = -1, uniformCount = -1;
+};
+
+// Largest difference allowed between CPU and GPU particles; the shader
+// forbids fused operations, this only covers drivers that ignore it
+constexpr float ComputeParityTolerance = 1e-4f;
+
+// Runs the same particles through IntegrateScalar and the compute shader and
+// returns the largest difference over every float of the Particule layout
+// read back from the SSBO, positions measured around the wrapped domain.
+// See GpuCheck, which runs it without a display.
+float ComputeParityError(GLuint program, std::size_t n, int steps, float dt);
@@ -0,0 +1,295 @@
+#include "cull.h"
+
+#include "simd.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+
+Frustum FrustumFromMatrix(const glm::mat4& clip)
+{
+	// Row r of the matrix, glm being column major
+	auto row = [&clip](int r, int c) { return clip[c][r]; };
+
+	Frustum f;
+	for (int plane = 0; plane < 6; plane++)
+	{
+		const int axis = plane / 2;
+		const float sign = plane % 2 ? -1.f : 1.f;
+		f.a[plane] = row(3, 0) + sign * row(axis, 0);
+		f.b[plane] = row(3, 1) + sign * row(axis, 1);
+		f.c[plane] = row(3, 2) + sign * row(axis, 2);
+		f.d[plane] = row(3, 3) + sign * row(axis, 3);
+	}
+	return f;
+}
+
+// Every kernel evaluates the planes with the same operations in the same
+// order, so they agree on the particles lying exactly on a plane
+static inline bool inside(const Frustum& f, float x, float y, float z)
+{
+	bool in = true;
+	for (int k = 0; k < 6; k++)
+		in &= ((f.a[k] * x + f.b[k] * y) + f.c[k] * z) + f.d[k] >= 0.f;
+	return in;
+}
+
+std::size_t CullScalar(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out)
+{
+	std::size_t n = 0;
+	for (std::size_t i = begin; i < end; i++)
+	{
+		// Branchless: always write, only advance on a visible particle
+		out[n] = std::uint32_t(i);
+		n += inside(f, p.px[i], p.py[i], p.pz[i]);
+	}
+	return n;
+}
+
+#ifdef SIMD_X86
+
+static inline unsigned popcount8(unsigned m)
+{
+	m = m - ((m >> 1) & 0x55);
+	m = (m & 0x33) + ((m >> 2) & 0x33);
+	return (m + (m >> 4)) & 0x0f;
+}
+
+// For every 4-bit mask, the pshufb control moving the selected 32-bit lanes to the front
+struct CompactTable4
+{
+	alignas(16) std::uint8_t control[16][16];
+
+	CompactTable4()
+	{
+		for (unsigned mask = 0; mask < 16; mask++)
+		{
+			unsigned k = 0;
+			for (unsigned lane = 0; lane < 4; lane++)
+			{
+				if (mask & (1u << lane))
+				{
+					for (unsigned byte = 0; byte < 4; byte++)
+						control[mask][4 * k + byte] = std::uint8_t(4 * lane + byte);
+					k++;
+				}
+			}
+			for (; k < 4; k++)
+			{
+				for (unsigned byte = 0; byte < 4; byte++)
+					control[mask][4 * k + byte] = 0x80;
+			}
+		}
+	}
+};
+
+// For every 8-bit mask, the selected lanes packed as 4-bit indices, first lane lowest
+struct CompactTable8
+{
+	std::uint32_t lanes[256];
+
+	CompactTable8()
+	{
+		for (unsigned mask = 0; mask < 256; mask++)
+		{
+			std::uint32_t packed = 0;
+			unsigned k = 0;
+			for (unsigned lane = 0; lane < 8; lane++)
+			{
+				if (mask & (1u << lane))
+					packed |= lane << (4 * k++);
+			}
+			lanes[mask] = packed;
+		}
+	}
+};
+
+static const CompactTable4 compact4;
+static const CompactTable8 compact8;
+
+TARGET_SSE4 std::size_t CullSSE4(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out)
+{
+	std::size_t n = 0;
+	std::size_t i = begin;
+	const __m128 zero = _mm_setzero_ps();
+
+	for (; i + 4 <= end; i += 4)
+	{
+		const __m128 x = _mm_loadu_ps(&p.px[i]);
+		const __m128 y = _mm_loadu_ps(&p.py[i]);
+		const __m128 z = _mm_loadu_ps(&p.pz[i]);
+
+		__m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int k = 0; k < 6; k++)
+		{
+			__m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(f.a[k]), x), _mm_mul_ps(_mm_set1_ps(f.b[k]), y));
+			s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(f.c[k]), z));
+			s = _mm_add_ps(s, _mm_set1_ps(f.d[k]));
+			in = _mm_and_ps(in, _mm_cmpge_ps(s, zero));
+		}
+
+		const unsigned mask = unsigned(_mm_movemask_ps(in));
+		const __m128i index = _mm_add_epi32(_mm_set1_epi32(int(i)), _mm_setr_epi32(0, 1, 2, 3));
+		const __m128i control = _mm_load_si128((const __m128i*) compact4.control[mask]);
+		_mm_storeu_si128((__m128i*) (out + n), _mm_shuffle_epi8(index, control));
+		n += popcount8(mask);
+	}
+
+	return n + CullScalar(p, i, end, f, out + n);
+}
+
+TARGET_AVX2 std::size_t CullAVX2(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out)
+{
+	std::size_t n = 0;
+	std::size_t i = begin;
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i nibbles = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+
+	for (; i + 8 <= end; i += 8)
+	{
+		const __m256 x = _mm256_loadu_ps(&p.px[i]);
+		const __m256 y = _mm256_loadu_ps(&p.py[i]);
+		const __m256 z = _mm256_loadu_ps(&p.pz[i]);
+
+		__m256 in = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int k = 0; k < 6; k++)
+		{
+			__m256 s = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(f.a[k]), x), _mm256_mul_ps(_mm256_set1_ps(f.b[k]), y));
+			s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_set1_ps(f.c[k]), z));
+			s = _mm256_add_ps(s, _mm256_set1_ps(f.d[k]));
+			in = _mm256_and_ps(in, _mm256_cmp_ps(s, zero, _CMP_GE_OQ));
+		}
+
+		// Unpack the lane list of the mask and move those lanes to the front
+		const unsigned mask = unsigned(_mm256_movemask_ps(in));
+		const __m256i packed = _mm256_set1_epi32(int(compact8.lanes[mask]));
+		const __m256i permutation = _mm256_and_si256(_mm256_srlv_epi32(packed, nibbles), _mm256_set1_epi32(0xf));
+		const __m256i index = _mm256_add_epi32(_mm256_set1_epi32(int(i)), lane);
+		_mm256_storeu_si256((__m256i*) (out + n), _mm256_permutevar8x32_epi32(index, permutation));
+		n += popcount8(mask);
+	}
+
+	return n + CullSSE4(p, i, end, f, out + n);
+}
+
+#else
+
+std::size_t CullSSE4(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out)
+{
+	return CullScalar(p, begin, end, f, out);
+}
+
+std::size_t CullAVX2(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out)
+{
+	return CullScalar(p, begin, end, f, out);
+}
+
+#endif
+
+CullKernel SelectCuller()
+{
+	if (CpuHasAVX2())
+		return CullAVX2;
+	return CpuHasSSE4() ? CullSSE4 : CullScalar;
+}
+
+const char* CullerName(CullKernel kernel)
+{
+	if (kernel == CullAVX2)
+		return "AVX2";
+	if (kernel == CullSSE4)
+		return "SSE4";
+	return "Scalar";
+}
+
+bool VerifyCuller(CullKernel kernel, std::size_t n)
+{
+	const ParticleStore store = MakeParticules(int(n));
+	DrawableParticles p(n);
+	p.Resize(n);
+	p.Copy(store, 0, n);
+
+	// Planes at +-0.5 for the scaled box: every fifth particle lies on one
+	for (std::size_t i = 0; i < n; i += 5)
+		(i % 2 ? p.px : p.pz)[i] = i % 3 ? 0.5f : -0.5f;
+
+	const glm::mat4 frusta[] = {
+		glm::scale(glm::mat4(1.f), glm::vec3(2.f)),
+		glm::perspective(1.f, 1.3f, 0.1f, 10.f) * glm::translate(glm::mat4(1.f), glm::vec3(0.2f, -0.1f, -1.5f)),
+		glm::perspective(0.5f, 1.f, 0.5f, 3.f) * glm::rotate(glm::translate(glm::mat4(1.f), glm::vec3(0.f, 0.f, -2.f)), 0.7f, glm::vec3(1.f, 1.f, 0.f)),
+	};
+
+	std::vector<std::uint32_t> expected(n), tested(n);
+	for (const glm::mat4& clip : frusta)
+	{
+		const Frustum f = FrustumFromMatrix(clip);
+		for (std::size_t begin = 0; begin < 8; begin++)
+		{
+			const std::size_t count = CullScalar(p, begin, n, f, expected.data());
+			if (kernel(p, begin, n, f, tested.data()) != count ||
+				!std::equal(expected.begin(), expected.begin() + count, tested.begin()))
+				return false;
+		}
+	}
+	return true;
+}
+
+static void write(const DrawableParticles& p, Particule* out, const std::uint32_t* indices, std::size_t n, float alpha)
+{
+	p.InterleaveIndexed(out, indices, n, alpha);
+}
+
+static void write(const DrawableParticles& p, PackedParticule* out, const std::uint32_t* indices, std::size_t n, float alpha)
+{
+	p.PackIndexed(out, indices, n, alpha);
+}
+
+std::size_t FrustumCuller::Cull(const DrawableParticles& p, const glm::mat4& clip, float alpha, Particule* out, JobSystem& jobs)
+{
+	return cull(p, clip, alpha, out, jobs);
+}
+
+std::size_t FrustumCuller::Cull(const DrawableParticles& p, const glm::mat4& clip, float alpha, PackedParticule* out, JobSystem& jobs)
+{
+	return cull(p, clip, alpha, out, jobs);
+}
+
+template<typename Vertex>
+std::size_t FrustumCuller::cull(const DrawableParticles& p, const glm::mat4& clip, float alpha, Vertex* out, JobSystem& jobs)
+{
+	const std::size_t n = p.Size();
+	const std::size_t chunks = (n + chunk - 1) / chunk;
+	const Frustum f = FrustumFromMatrix(clip);
+
+	scratch.resize(n);
+	visible.resize(n);
+	counts.resize(chunks);
+	offsets.resize(chunks);
+
+	// Each chunk compacts into its own range of the scratch list
+	const CullKernel test = kernel;
+	jobs.ParallelFor(0, n, chunk, [&](std::size_t b, std::size_t e) {
+		counts[b / chunk] = test(p, b, e, f, scratch.data() + b);
+	});
+
+	std::size_t total = 0;
+	for (std::size_t c = 0; c < chunks; c++)
+	{
+		offsets[c] = total;
+		total += counts[c];
+	}
+
+	jobs.ParallelFor(0, n, chunk, [&](std::size_t b, std::size_t /*e*/) {
+		const std::size_t c = b / chunk;
+		const std::uint32_t* indices = scratch.data() + b;
+		std::copy(indices, indices + counts[c], visible.data() + offsets[c]);
+		write(p, out + offsets[c], indices, counts[c], alpha);
+	});
+	visible.resize(total);
+
+	stats.tested = n;
+	stats.visible = total;
+	stats.bytesSaved = (n - total) * sizeof(Vertex);
+	return total;
+}
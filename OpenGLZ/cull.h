@@ -0,0 +1,73 @@
+#pragma once
+
+#include "jobs.h"
+#include "particles.h"
+
+#include <glm/mat4x4.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Six planes a x + b y + c z + d >= 0 bounding the visible volume, in the
+// space of the positions the clip matrix is applied to
+struct Frustum
+{
+	float a[6], b[6], c[6], d[6];
+};
+
+// Planes of the clip space box -w <= x, y, z <= w (Gribb and Hartmann)
+Frustum FrustumFromMatrix(const glm::mat4& clip);
+
+// Writes the indices of the particles of [begin, end) inside the frustum to
+// out, in order, and returns their count. out must hold end - begin indices:
+// the kernels store whole vectors, past the last visible one.
+typedef std::size_t (*CullKernel)(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out);
+
+std::size_t CullScalar(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out);
+std::size_t CullSSE4(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out);
+std::size_t CullAVX2(const DrawableParticles& p, std::size_t begin, std::size_t end, const Frustum& f, std::uint32_t* out);
+
+// Best kernel supported by this CPU
+CullKernel SelectCuller();
+const char* CullerName(CullKernel kernel);
+
+// Runs kernel and the scalar reference on the same random particles, some
+// outside and some exactly on the planes of a few frusta, over ranges of
+// every alignment, and checks they list the same particles
+bool VerifyCuller(CullKernel kernel, std::size_t n = 1021);
+
+struct CullStats
+{
+	std::size_t tested = 0;
+	std::size_t visible = 0;
+	std::size_t bytesSaved = 0; // upload avoided by the culled particles
+};
+
+// Frustum culling with stream compaction: chunks are culled in parallel into
+// their own range of a scratch list, a prefix sum over the chunk counts gives
+// the place of each chunk in the compacted list, and the visible particles are
+// then interleaved straight to the upload buffer.
+class FrustumCuller
+{
+public:
+	CullKernel kernel = SelectCuller();
+	std::size_t chunk = 16384; // particles per job
+
+	// Writes the visible particles of p to out, blended by alpha as by
+	// ParticleStore::Interleave, and returns their count
+	std::size_t Cull(const DrawableParticles& p, const glm::mat4& clip, float alpha, Particule* out, JobSystem& jobs);
+	std::size_t Cull(const DrawableParticles& p, const glm::mat4& clip, float alpha, PackedParticule* out, JobSystem& jobs);
+
+	// Indices of the particles written by the last Cull, in order
+	const std::vector<std::uint32_t>& Visible() const { return visible; }
+	const CullStats& Stats() const { return stats; }
+
+private:
+	template<typename Vertex>
+	std::size_t cull(const DrawableParticles& p, const glm::mat4& clip, float alpha, Vertex* out, JobSystem& jobs);
+
+	std::vector<std::uint32_t> scratch, visible;
+	std::vector<std::size_t> counts, offsets;
+	CullStats stats;
+};
@@ -0,0 +1,51 @@
+#include "emitter.h"
+
+#include "random.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::size_t Emitter::Update(ParticleStore& p, float dt, JobSystem& jobs)
+{
+	jobs.ParallelFor(0, p.Size(), 0, [&p, dt](std::size_t b, std::size_t e) {
+		for (std::size_t i = b; i < e; i++)
+			p.life[i] -= dt;
+	});
+	killed += p.KillExpired();
+
+	const float due = carry + rate * dt;
+	std::size_t n = std::size_t(due) + pendingBurst;
+	carry = due - std::floor(due);
+	pendingBurst = 0;
+
+	const std::size_t first = p.Spawn(n);
+	n = p.Size() - first;
+	emit(p, first, n, jobs);
+
+	spawned += n;
+	return n;
+}
+
+void Emitter::emit(ParticleStore& p, std::size_t first, std::size_t n, JobSystem& jobs)
+{
+	jobs.ParallelFor(first, first + n, 0, [&](std::size_t b, std::size_t e) {
+		for (std::size_t i = b; i < e; i++)
+		{
+			const std::size_t k = spawned + (i - first);
+			const Philox4x32 r0 = RandomBlock(seed, RandomStream::Emitter, k, 0);
+			const Philox4x32 r1 = RandomBlock(seed, RandomStream::Emitter, k, 1);
+
+			p.px[i] = p.prevX[i] = position.x + radius * RandomRange(r0.v[0], -1.f, 1.f);
+			p.py[i] = p.prevY[i] = position.y + radius * RandomRange(r0.v[1], -1.f, 1.f);
+			p.pz[i] = p.prevZ[i] = position.z + radius * RandomRange(r0.v[2], -1.f, 1.f);
+			p.mass[i] = mass;
+
+			p.vx[i] = velocity.x + velocityJitter * RandomRange(r0.v[3], -1.f, 1.f);
+			p.vy[i] = velocity.y + velocityJitter * RandomRange(r1.v[0], -1.f, 1.f);
+			p.vz[i] = velocity.z + velocityJitter * RandomRange(r1.v[1], -1.f, 1.f);
+
+			p.color[i] = color;
+			p.life[i] = std::max(0.f, lifetime + lifetimeJitter * RandomRange(r1.v[2], -1.f, 1.f));
+		}
+	});
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "jobs.h"
+#include "particles.h"
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// Spawns particles into the free tail of a ParticleStore and retires them when
+// their life runs out. Everything lives in the store's preallocated arrays:
+// a dead particle is replaced by the last live one, so the live particles stay
+// dense in [0, Size()) and neither the store nor the VBO is reallocated.
+class Emitter
+{
+public:
+	float rate = 0.f; // particles per second
+	float lifetime = 2.f; // seconds
+	float lifetimeJitter = 0.5f; // lifetimes are in lifetime +- jitter
+
+	glm::vec3 position = glm::vec3(0.f, 0.5f, 0.f);
+	float radius = 0.05f;
+	glm::vec3 velocity = glm::vec3(0.f, 0.5f, 0.f);
+	float velocityJitter = 0.2f;
+	float mass = 50.f;
+	glm::vec4 color = glm::vec4(1.f, 0.6f, 0.2f, 1.f);
+	std::uint64_t seed = 0x5EED;
+
+	// Queues n particles for the next Update
+	void Burst(std::size_t n) { pendingBurst += n; }
+
+	// Ages every particle by dt, kills the expired ones then spawns the due
+	// ones (as many as the free capacity allows). Returns the spawn count.
+	std::size_t Update(ParticleStore& p, float dt, JobSystem& jobs);
+
+	std::size_t Spawned() const { return spawned; }
+	std::size_t Killed() const { return killed; }
+
+private:
+	// The k-th particle ever spawned draws from counter k, so the spawns are
+	// filled in parallel and the same for any worker count
+	void emit(ParticleStore& p, std::size_t first, std::size_t n, JobSystem& jobs);
+
+	float carry = 0.f; // fraction of a particle left over from the rate
+	std::size_t pendingBurst = 0;
+	std::size_t spawned = 0, killed = 0;
+};
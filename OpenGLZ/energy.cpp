@@ -0,0 +1,178 @@
+#include "energy.h"
+
+#include "random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Sums f(b, e) over chunks of [0, n) in parallel, in a fixed order
+template<typename F>
+static double reduce(std::size_t n, JobSystem& jobs, F f)
+{
+	const std::size_t chunk = 65536;
+	std::vector<double> partial((n + chunk - 1) / chunk);
+	jobs.ParallelFor(0, n, chunk, [&](std::size_t b, std::size_t e) { partial[b / chunk] = f(b, e); });
+
+	double sum = 0.0;
+	for (const double s : partial)
+		sum += s;
+	return sum;
+}
+
+double KineticEnergy(const ParticleStore& p, JobSystem& jobs)
+{
+	return reduce(p.Size(), jobs, [&p](std::size_t b, std::size_t e) {
+		double sum = 0.0;
+		for (std::size_t i = b; i < e; i++)
+			sum += 0.5 * p.mass[i] * (double(p.vx[i]) * p.vx[i] + double(p.vy[i]) * p.vy[i] + double(p.vz[i]) * p.vz[i]);
+		return sum;
+	});
+}
+
+double UniformPotentialEnergy(const ParticleStore& p, float g, JobSystem& jobs)
+{
+	return reduce(p.Size(), jobs, [&p, g](std::size_t b, std::size_t e) {
+		double sum = 0.0;
+		for (std::size_t i = b; i < e; i++)
+			sum -= double(p.mass[i]) * p.mass[i] * g * p.py[i];
+		return sum;
+	});
+}
+
+double PairPotentialEnergy(const ParticleStore& p, const float* phi, JobSystem& jobs)
+{
+	return reduce(p.Size(), jobs, [&p, phi](std::size_t b, std::size_t e) {
+		double sum = 0.0;
+		for (std::size_t i = b; i < e; i++)
+			sum += 0.5 * p.mass[i] * phi[i];
+		return sum;
+	});
+}
+
+double EnergyMonitor::Sample(const Energy& e)
+{
+	if (samples++ == 0)
+		reference = e;
+	last = e;
+
+	const double e0 = reference.Total();
+	drift = e0 != 0.0 ? std::abs(e.Total() - e0) / std::abs(e0) : 0.0;
+	maxDrift = std::max(maxDrift, drift);
+	return drift;
+}
+
+/* REFERENCE PROBLEM */
+
+static void directForces(const ParticleStore& p, float softening, float* ax, float* ay, float* az, float* phi)
+{
+	const float eps2 = softening * softening;
+	for (std::size_t i = 0; i < p.Size(); i++)
+	{
+		float fx = 0.f, fy = 0.f, fz = 0.f, pot = 0.f;
+		for (std::size_t j = 0; j < p.Size(); j++)
+		{
+			if (j == i)
+				continue;
+			const float dx = p.px[j] - p.px[i];
+			const float dy = p.py[j] - p.py[i];
+			const float dz = p.pz[j] - p.pz[i];
+			const float inv = 1.f / std::sqrt(dx * dx + dy * dy + dz * dz + eps2);
+			const float s = p.mass[j] * inv * inv * inv;
+			fx += dx * s;
+			fy += dy * s;
+			fz += dz * s;
+			pot += p.mass[j] * inv;
+		}
+		ax[i] = fx;
+		ay[i] = fy;
+		az[i] = fz;
+		if (phi)
+			phi[i] = -pot;
+	}
+}
+
+static double totalEnergy(const ParticleStore& p, const float* phi)
+{
+	double e = 0.0;
+	for (std::size_t i = 0; i < p.Size(); i++)
+		e += 0.5 * p.mass[i] * (double(p.vx[i]) * p.vx[i] + double(p.vy[i]) * p.vy[i] + double(p.vz[i]) * p.vz[i] + phi[i]);
+	return e;
+}
+
+double EnergyDriftTest(IntegrationScheme scheme, float dt, int steps, std::size_t n)
+{
+	const float softening = 1e-3f;
+	const float centralMass = 1.f;
+	const float bodyMass = 1e-6f;
+
+	ParticleStore p(n + 1);
+	p.Spawn(n + 1);
+	for (std::size_t i = 0; i <= n; i++)
+	{
+		p.px[i] = p.py[i] = p.pz[i] = 0.f;
+		p.vx[i] = p.vy[i] = p.vz[i] = 0.f;
+		p.mass[i] = i == 0 ? centralMass : bodyMass;
+	}
+
+	// Circular orbits in random planes: r along a random unit vector, v orthogonal to it
+	for (std::size_t i = 1; i <= n; i++)
+	{
+		const Philox4x32 bits = RandomBlock(1, RandomStream::Init, i);
+		const float r = 0.2f + 0.6f * float(i - 1) / float(n > 1 ? n - 1 : 1);
+		const float z = RandomRange(bits.v[0], -1.f, 1.f);
+		const float a = RandomRange(bits.v[1], 0.f, 6.2831853f);
+		const float s = std::sqrt(1.f - z * z);
+		const float ux = s * std::cos(a), uy = s * std::sin(a), uz = z;
+
+		// Any vector not along u, crossed with it
+		const float wx = std::abs(ux) < 0.9f ? 1.f : 0.f, wy = 1.f - wx;
+		float tx = wy * uz, ty = -wx * uz, tz = wx * uy - wy * ux;
+		const float t = std::sqrt(tx * tx + ty * ty + tz * tz);
+		const float v = std::sqrt(centralMass / r);
+		tx *= v / t;
+		ty *= v / t;
+		tz *= v / t;
+
+		p.px[i] = r * ux;
+		p.py[i] = r * uy;
+		p.pz[i] = r * uz;
+		p.vx[i] = tx;
+		p.vy[i] = ty;
+		p.vz[i] = tz;
+	}
+
+	std::vector<float> ax(n + 1), ay(n + 1), az(n + 1), phi(n + 1);
+	directForces(p, softening, ax.data(), ay.data(), az.data(), phi.data());
+	const double e0 = totalEnergy(p, phi.data());
+
+	// Same sequences as Simulation, over the whole store; drifting with g = 0
+	// is the semi-implicit Euler position update
+	const std::size_t count = n + 1;
+	double worst = 0.0;
+	for (int s = 0; s < steps; s++)
+	{
+		switch (scheme)
+		{
+		case IntegrationScheme::SemiImplicitEuler:
+			Kick(p, 0, count, ax.data(), ay.data(), az.data(), dt);
+			IntegrateScalar(p, 0, count, dt, 0.f);
+			break;
+		case IntegrationScheme::VelocityVerlet:
+			DriftVerlet(p, 0, count, ax.data(), ay.data(), az.data(), dt);
+			Kick(p, 0, count, ax.data(), ay.data(), az.data(), 0.5f * dt);
+			break;
+		case IntegrationScheme::LeapfrogKDK:
+			Kick(p, 0, count, ax.data(), ay.data(), az.data(), 0.5f * dt);
+			IntegrateScalar(p, 0, count, dt, 0.f);
+			break;
+		}
+
+		directForces(p, softening, ax.data(), ay.data(), az.data(), phi.data());
+		if (scheme != IntegrationScheme::SemiImplicitEuler)
+			Kick(p, 0, count, ax.data(), ay.data(), az.data(), 0.5f * dt);
+
+		worst = std::max(worst, std::abs(totalEnergy(p, phi.data()) - e0) / std::abs(e0));
+	}
+	return worst;
+}
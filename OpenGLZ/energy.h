@@ -0,0 +1,55 @@
+#pragma once
+
+#include "integrator.h"
+#include "jobs.h"
+#include "particles.h"
+
+#include <cstddef>
+
+struct Energy
+{
+	double kinetic = 0.0;
+	double potential = 0.0;
+
+	double Total() const { return kinetic + potential; }
+};
+
+// Sum of m v^2 / 2
+double KineticEnergy(const ParticleStore& p, JobSystem& jobs);
+
+// Potential energy in the uniform field. The acceleration of a particle is
+// m g (see IntegrateKernel), so its potential energy is -m (m g) y.
+double UniformPotentialEnergy(const ParticleStore& p, float g, JobSystem& jobs);
+
+// Sum of m phi / 2 over the pairwise potentials phi of the particles
+double PairPotentialEnergy(const ParticleStore& p, const float* phi, JobSystem& jobs);
+
+// Relative drift |E - E0| / |E0| of the total energy, E0 being the first
+// sample since Reset. The wrap of the domain moves particles across the
+// field, which shows up as drift too.
+class EnergyMonitor
+{
+public:
+	void Reset() { samples = 0; maxDrift = 0.0; }
+
+	// Records a sample and returns its drift
+	double Sample(const Energy& e);
+
+	const Energy& Reference() const { return reference; }
+	const Energy& Last() const { return last; }
+	double Drift() const { return drift; }
+	double MaxDrift() const { return maxDrift; }
+	std::size_t Samples() const { return samples; }
+
+private:
+	Energy reference, last;
+	double drift = 0.0, maxDrift = 0.0;
+	std::size_t samples = 0;
+};
+
+// Largest energy drift of a scheme over steps of dt on a reference problem:
+// n light bodies on circular orbits of radius 0.2 to 0.8 around a heavy one,
+// with G M = 1, direct summation and no wrap. The innermost period is about
+// 0.56 s. The second-order schemes keep the drift Euler has at dt for steps
+// several times larger, which is what Bench --drift measures.
+double EnergyDriftTest(IntegrationScheme scheme, float dt, int steps, std::size_t n = 32);
@@ -0,0 +1,140 @@
+#include "grid.h"
+
+#include <cmath>
+
+static constexpr std::size_t BlockSize = 16384; // particles, at least
+static constexpr std::size_t MaxBlocks = 64;
+static constexpr std::size_t CellRange = 16384; // cells per job of the prefix sum
+
+int SpatialGrid::resolutionFor(float size)
+{
+	return std::max(1, std::min(256, int(std::floor(2.f / size))));
+}
+
+std::size_t SpatialGrid::blocksFor(std::size_t n, std::size_t cells, std::size_t most)
+{
+	return std::max<std::size_t>(1, std::min({n / BlockSize, most, 4 * n / cells}));
+}
+
+void SpatialGrid::Reserve(std::size_t n, float size)
+{
+	cells.reserve(n);
+	index.reserve(n);
+	sx.reserve(n);
+	sy.reserve(n);
+	sz.reserve(n);
+
+	resolution = resolutionFor(size);
+	const std::size_t cellTotal = std::size_t(resolution) * resolution * resolution;
+	cellStart.assign(cellTotal, 0);
+	cellCount.assign(cellTotal, 0);
+	blockCounts.reserve(blocksFor(n, cellTotal, MaxBlocks) * cellTotal);
+	rangeTotals.reserve((cellTotal + CellRange - 1) / CellRange);
+}
+
+void SpatialGrid::Build(const float* x, const float* y, const float* z, std::size_t n, float size, JobSystem& jobs)
+{
+	const int res = resolutionFor(size);
+	if (res != resolution)
+	{
+		resolution = res;
+		cellStart.assign(std::size_t(res) * res * res, 0);
+		cellCount.assign(std::size_t(res) * res * res, 0);
+	}
+	cellSize = 2.f / float(res);
+	invCellSize = float(res) / 2.f;
+
+	cells.resize(n);
+	index.resize(n);
+	sx.resize(n);
+	sy.resize(n);
+	sz.resize(n);
+
+	const std::size_t cellTotal = cellStart.size();
+	if (n == 0)
+	{
+		std::fill(cellStart.begin(), cellStart.end(), 0);
+		std::fill(cellCount.begin(), cellCount.end(), 0);
+		return;
+	}
+
+	// A few blocks per thread so that stealing can even out the load
+	const std::size_t blocks = blocksFor(n, cellTotal, std::min<std::size_t>(MaxBlocks, (jobs.WorkerCount() + 1) * 4));
+	const std::size_t blockSize = (n + blocks - 1) / blocks;
+	blockCounts.resize(blocks * cellTotal);
+
+	// Cells and their count in every block
+	jobs.ParallelFor(0, n, blockSize, [&](std::size_t b, std::size_t e) {
+		std::uint32_t* counts = &blockCounts[(b / blockSize) * cellTotal];
+		std::fill(counts, counts + cellTotal, 0);
+		for (std::size_t i = b; i < e; i++)
+		{
+			cells[i] = CellOf(x[i], y[i], z[i]);
+			counts[cells[i]]++;
+		}
+	});
+
+	// Cell major, block minor: block k writes its particles of cell c after
+	// every smaller cell and after the c's of the blocks before it. Ranges of
+	// cells sum their counts, then turn them into offsets from their start.
+	const std::size_t ranges = (cellTotal + CellRange - 1) / CellRange;
+	rangeTotals.resize(ranges);
+	jobs.ParallelFor(0, cellTotal, CellRange, [&](std::size_t b, std::size_t e) {
+		std::uint32_t total = 0;
+		for (std::size_t c = b; c < e; c++)
+		{
+			std::uint32_t count = 0;
+			for (std::size_t k = 0; k < blocks; k++)
+				count += blockCounts[k * cellTotal + c];
+			cellCount[c] = count;
+			total += count;
+		}
+		rangeTotals[b / CellRange] = total;
+	});
+
+	std::uint32_t offset = 0;
+	for (auto& t : rangeTotals)
+	{
+		const std::uint32_t count = t;
+		t = offset;
+		offset += count;
+	}
+
+	jobs.ParallelFor(0, cellTotal, CellRange, [&](std::size_t b, std::size_t e) {
+		std::uint32_t at = rangeTotals[b / CellRange];
+		for (std::size_t c = b; c < e; c++)
+		{
+			cellStart[c] = at;
+			for (std::size_t k = 0; k < blocks; k++)
+			{
+				std::uint32_t& count = blockCounts[k * cellTotal + c];
+				const std::uint32_t blockCount = count;
+				count = at;
+				at += blockCount;
+			}
+		}
+	});
+
+	jobs.ParallelFor(0, n, blockSize, [&](std::size_t b, std::size_t e) {
+		std::uint32_t* offsets = &blockCounts[(b / blockSize) * cellTotal];
+		for (std::size_t i = b; i < e; i++)
+			index[offsets[cells[i]]++] = std::uint32_t(i);
+	});
+
+	jobs.ParallelFor(0, n, 0, [&](std::size_t b, std::size_t e) {
+		for (std::size_t k = b; k < e; k++)
+		{
+			const auto i = index[k];
+			sx[k] = x[i];
+			sy[k] = y[i];
+			sz[k] = z[i];
+		}
+	});
+}
+
+std::size_t SpatialGrid::Query(float x, float y, float z, float r, std::vector<std::uint32_t>& out) const
+{
+	const std::size_t before = out.size();
+	ForEachNeighbor(x, y, z, r, [&out](std::uint32_t j, float, float, float, float) { out.push_back(j); });
+	return out.size() - before;
+}
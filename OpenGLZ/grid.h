@@ -0,0 +1,94 @@
+#pragma once
+
+#include "jobs.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Uniform grid over the [-1, 1] cube for neighbour queries.
+// Build bins the particles by counting sort: the particles of cell c are
+// Index()[CellStart()[c] .. + CellCount()[c]], and their positions are copied
+// in the same order so that the distance tests stream contiguous memory.
+// Blocks of particles count their cells in parallel, a prefix sum over
+// (cell, block) gives every block its offsets and the blocks scatter in
+// parallel, so a cell lists its particles in store order.
+// Queries do not look across the wrapped faces of the domain.
+class SpatialGrid
+{
+public:
+	// Sizes the buffers for up to n particles and the cells of cellSize, so that Build does not allocate
+	void Reserve(std::size_t n, float cellSize);
+
+	// The cell size is rounded up so that a whole number of cells (256 at most
+	// per axis) spans the domain
+	void Build(const float* x, const float* y, const float* z, std::size_t n, float cellSize, JobSystem& jobs);
+
+	int Resolution() const { return resolution; }
+	float CellSize() const { return cellSize; }
+	std::uint32_t CellOf(float x, float y, float z) const
+	{
+		return (std::uint32_t(coord(z)) * resolution + std::uint32_t(coord(y))) * resolution + std::uint32_t(coord(x));
+	}
+
+	const std::vector<std::uint32_t>& CellStart() const { return cellStart; }
+	const std::vector<std::uint32_t>& CellCount() const { return cellCount; }
+	const std::vector<std::uint32_t>& Index() const { return index; }
+
+	// Calls fn(j, dx, dy, dz, d2) for every particle j with d2 = |p_j - (x, y, z)|^2 <= r^2
+	template<typename F>
+	void ForEachNeighbor(float x, float y, float z, float r, F&& fn) const
+	{
+		const int x0 = coord(x - r), x1 = coord(x + r);
+		const int y0 = coord(y - r), y1 = coord(y + r);
+		const int z0 = coord(z - r), z1 = coord(z + r);
+		const float r2 = r * r;
+
+		for (int cz = z0; cz <= z1; cz++)
+		{
+			for (int cy = y0; cy <= y1; cy++)
+			{
+				// Cells along x are adjacent, so is their content
+				const std::size_t row = (std::size_t(cz) * resolution + cy) * resolution;
+				const std::uint32_t begin = cellStart[row + x0];
+				const std::uint32_t end = cellStart[row + x1] + cellCount[row + x1];
+
+				for (std::uint32_t k = begin; k < end; k++)
+				{
+					const float dx = sx[k] - x;
+					const float dy = sy[k] - y;
+					const float dz = sz[k] - z;
+					const float d2 = dx * dx + dy * dy + dz * dz;
+					if (d2 <= r2)
+						fn(index[k], dx, dy, dz, d2);
+				}
+			}
+		}
+	}
+
+	// Appends the indices of the particles within r of (x, y, z), returns how many
+	std::size_t Query(float x, float y, float z, float r, std::vector<std::uint32_t>& out) const;
+
+private:
+	static int resolutionFor(float cellSize);
+	// Particle blocks of a build, up to most and bounded so that their counts
+	// stay within a few per particle
+	static std::size_t blocksFor(std::size_t n, std::size_t cells, std::size_t most);
+
+	int coord(float v) const
+	{
+		const int c = int((v + 1.f) * invCellSize);
+		return std::min(std::max(c, 0), resolution - 1);
+	}
+
+	int resolution = 0;
+	float cellSize = 0.f, invCellSize = 0.f;
+
+	std::vector<std::uint32_t> cells; // cell of every particle, in store order
+	std::vector<std::uint32_t> cellStart, cellCount;
+	std::vector<std::uint32_t> blockCounts; // block major, then offsets of the blocks in their cells
+	std::vector<std::uint32_t> rangeTotals; // particles per range of cells
+	std::vector<std::uint32_t> index;
+	std::vector<float> sx, sy, sz;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "particles.h"
+
+#include <cstddef>
+
+// Vertical acceleration per unit of mass of the uniform gravity field
+constexpr float Gravity = -9.81f * 0.1f;
+
+// Every kernel performs the same float operations in the same order (no FMA
+// contraction), so the SIMD variants match the scalar reference bit for bit.
+// VerifyIntegrator accepts up to this many ULPs of difference per component.
+constexpr unsigned IntegratorUlpTolerance = 0;
+
+// Euler step of particles [begin, end) under a vertical acceleration of
+// mass * g, then wrap around the [-1, 1] cube
+typedef void (*IntegrateKernel)(ParticleStore& p, std::size_t begin, std::size_t end, float dt, float g);
+
+void IntegrateScalar(ParticleStore& p, std::size_t begin, std::size_t end, float dt, float g);
+void IntegrateSSE4(ParticleStore& p, std::size_t begin, std::size_t end, float dt, float g);
+void IntegrateAVX2(ParticleStore& p, std::size_t begin, std::size_t end, float dt, float g);
+
+enum class IntegratorVariant
+{
+	Auto,
+	Scalar,
+	SSE4,
+	AVX2
+};
+
+// Returns the requested kernel, or the best one supported by this CPU
+// (requests for an unsupported instruction set fall back as well)
+IntegrateKernel SelectIntegrator(IntegratorVariant variant = IntegratorVariant::Auto);
+const char* IntegratorName(IntegrateKernel kernel);
+
+// Time integration schemes of the simulation. Semi-implicit Euler kicks with
+// the accelerations at the start of the step then drifts (first order). Velocity
+// Verlet and leapfrog kick-drift-kick are second order and symplectic, with one
+// force evaluation per step as the accelerations at the end of a step are those
+// at the start of the next; Verlet advances positions with v dt + a dt^2 / 2,
+// KDK with the half-step velocity.
+enum class IntegrationScheme
+{
+	SemiImplicitEuler,
+	VelocityVerlet,
+	LeapfrogKDK
+};
+
+const char* SchemeName(IntegrationScheme scheme);
+
+// Uniform gravity steps of the second-order schemes, same arguments as IntegrateKernel
+void IntegrateVerletScalar(ParticleStore& p, std::size_t begin, std::size_t end, float dt, float g);
+void IntegrateLeapfrogScalar(ParticleStore& p, std::size_t begin, std::size_t end, float dt, float g);
+
+// Uniform gravity kernel of a scheme, euler being the (SIMD) semi-implicit Euler kernel
+IntegrateKernel UniformKernel(IntegrationScheme scheme, IntegrateKernel euler);
+
+// Building blocks for the schemes under arbitrary accelerations:
+// v += a h, and the Verlet drift x = wrap(x + v dt + a dt^2 / 2)
+void Kick(ParticleStore& p, std::size_t begin, std::size_t end, const float* ax, const float* ay, const float* az, float h);
+void DriftVerlet(ParticleStore& p, std::size_t begin, std::size_t end, const float* ax, const float* ay, const float* az, float dt);
+
+// Runs kernel and the scalar reference on the same random particles, moving
+// and wrapping on every axis, and checks the three positions and speeds are
+// within IntegratorUlpTolerance
+bool VerifyIntegrator(IntegrateKernel kernel, std::size_t n = 1021, int steps = 16);
@@ -0,0 +1,168 @@
+#include "jobs.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static void pinThread(std::thread& thread, unsigned core)
+{
+#if defined(_WIN32)
+	SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+	(void) thread;
+	(void) core;
+#endif
+}
+
+JobSystem::JobSystem(unsigned workerCount, bool pinThreads)
+{
+	if (workerCount == 0)
+	{
+		const unsigned hardware = std::thread::hardware_concurrency();
+		workerCount = hardware > 1 ? hardware - 1 : 1;
+	}
+
+	// One queue per worker, plus one fed by the threads outside of the pool
+	for (unsigned i = 0; i <= workerCount; i++)
+		queues.push_back(std::make_unique<Queue>());
+
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+		if (pinThreads)
+			pinThread(workers.back(), i + 1);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stop = true;
+	}
+	wakeUp.notify_all();
+
+	for (auto& w : workers)
+		w.join();
+}
+
+JobHandle JobSystem::ParallelForAsync(std::size_t begin, std::size_t end, std::size_t chunk, RangeFunction fn)
+{
+	auto batch = std::make_shared<JobBatch>();
+	batch->fn = std::move(fn);
+
+	if (end <= begin)
+		return batch;
+
+	if (chunk == 0)
+	{
+		// A few chunks per worker so that stealing can even out the load
+		chunk = (end - begin) / (queues.size() * 4);
+		chunk = std::max<std::size_t>(chunk, 4096);
+		chunk = (chunk + 7) / 8 * 8;
+	}
+
+	const std::size_t count = (end - begin + chunk - 1) / chunk;
+	batch->remaining = count;
+
+	// Counted before any push: a worker popping a job decrements pending
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		pending += count;
+	}
+
+	// Deal the chunks round robin so every worker starts with local work
+	const unsigned first = nextQueue++;
+	for (std::size_t c = 0; c < count; c++)
+	{
+		const std::size_t b = begin + c * chunk;
+		Queue& q = *queues[(first + c) % queues.size()];
+
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.jobs.push_back({batch, b, std::min(end, b + chunk)});
+	}
+	wakeUp.notify_all();
+
+	return batch;
+}
+
+void JobSystem::Wait(const JobHandle& batch)
+{
+	// The external queue is the last one
+	const unsigned self = unsigned(queues.size() - 1);
+
+	while (batch->remaining.load(std::memory_order_acquire) > 0)
+	{
+		Job job;
+		if (pop(self, job) || steal(self, job))
+			run(job);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::workerLoop(unsigned index)
+{
+	while (true)
+	{
+		Job job;
+		if (pop(index, job) || steal(index, job))
+		{
+			run(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [this] { return stop || pending > 0; });
+		if (stop)
+			return;
+	}
+}
+
+bool JobSystem::pop(unsigned index, Job& job)
+{
+	Queue& q = *queues[index];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if (q.jobs.empty())
+		return false;
+
+	job = q.jobs.back();
+	q.jobs.pop_back();
+	pending--;
+	return true;
+}
+
+bool JobSystem::steal(unsigned index, Job& job)
+{
+	const unsigned n = unsigned(queues.size());
+	for (unsigned k = 1; k < n; k++)
+	{
+		Queue& q = *queues[(index + k) % n];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.jobs.empty())
+			continue;
+
+		job = q.jobs.front();
+		q.jobs.pop_front();
+		pending--;
+		return true;
+	}
+	return false;
+}
+
+void JobSystem::run(const Job& job)
+{
+	job.batch->fn(job.begin, job.end);
+	job.batch->remaining.fetch_sub(1, std::memory_order_release);
+}
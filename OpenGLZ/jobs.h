@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void(std::size_t begin, std::size_t end)> RangeFunction;
+
+// A set of chunks spawned by one ParallelFor call
+struct JobBatch
+{
+	RangeFunction fn;
+	std::atomic<std::size_t> remaining{0};
+};
+
+typedef std::shared_ptr<JobBatch> JobHandle;
+
+// Work-stealing thread pool.
+// Every worker owns a deque: it pops its own jobs from the back and steals
+// from the front of the other deques when it runs dry. Threads waiting on
+// a batch run pending jobs instead of blocking.
+class JobSystem
+{
+public:
+	// workerCount 0 uses one worker per hardware thread minus the caller.
+	// With pinThreads, worker i is bound to core i + 1 (the caller keeps core 0).
+	explicit JobSystem(unsigned workerCount = 0, bool pinThreads = false);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	unsigned WorkerCount() const { return unsigned(workers.size()); }
+
+	// Splits [begin, end) in chunks of `chunk` items and queues
+	// fn(chunkBegin, chunkEnd) for each of them. With chunk 0 the size is picked
+	// from the worker count, as a multiple of 8 so SIMD kernels are not split.
+	// An explicit chunk is used as given: one-item jobs and callers numbering
+	// the chunks with chunkBegin / chunk rely on it. Ranges run through the
+	// SIMD kernels pass their size through SimdChunk.
+	JobHandle ParallelForAsync(std::size_t begin, std::size_t end, std::size_t chunk, RangeFunction fn);
+
+	// chunk rounded up to a multiple of 8, 0 staying automatic
+	static std::size_t SimdChunk(std::size_t chunk) { return (chunk + 7) / 8 * 8; }
+
+	// Runs queued jobs until every chunk of the batch is done
+	void Wait(const JobHandle& batch);
+
+	void ParallelFor(std::size_t begin, std::size_t end, std::size_t chunk, RangeFunction fn)
+	{
+		Wait(ParallelForAsync(begin, end, chunk, std::move(fn)));
+	}
+
+private:
+	struct Job
+	{
+		JobHandle batch;
+		std::size_t begin, end;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void workerLoop(unsigned index);
+	bool pop(unsigned index, Job& job);
+	bool steal(unsigned index, Job& job);
+	void run(const Job& job);
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::atomic<std::size_t> pending{0};
+	std::atomic<unsigned> nextQueue{0};
+	std::atomic<bool> stop{false};
+
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+};
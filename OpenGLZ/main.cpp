@@ -3,6 +3,15 @@
 #include "stl.h"
 #include "texture.h"
 #include "OBJLoader.h"
+#include "particles.h"
+#include "integrator.h"
+#include "jobs.h"
+#include "simthread.h"
+#include "simulation.h"
+#include "upload.h"
+#include "compute.h"
+#include "checkpoint.h"
+#include "cull.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
@@ -14,6 +23,9 @@
 #include <fstream>
 #include <string>
 #include <cmath>
+#include <cstring>
+#include <chrono>
+#include <thread>
 
 #define TINYPLY_IMPLEMENTATION
 #include <tinyply.h>
@@ -24,6 +36,62 @@ GLFWwindow* window;
 int width, height;
 int frameWidth = 500, frameHeight = 500;
 int nParticules = 10;
+int particuleCapacity = 100000;
+
+//----JOBS----
+unsigned workerThreads = 0; // simulation pool, 0: one per core left by the simulation and render threads
+unsigned renderWorkers = 1; // render thread pool, for culling and packing
+std::size_t particuleChunk = 0; // 0: automatic
+bool pinWorkers = false;
+
+//----TIMESTEP----
+double simulationStep = 1.0 / 120.0;
+int maxSubsteps = 8;
+bool realTime = true; // false: the simulation thread steps as fast as it can
+double maxFrameRate = 0.0; // frames per second on top of vsync, 0: no limit
+
+//----SIMULATION----
+SimulationMode simulationMode = SimulationMode::Uniform; // G toggles Barnes-Hut, F toggles the fluid
+float octreeTheta = 0.5f;
+IntegrationScheme integrationScheme = IntegrationScheme::SemiImplicitEuler; // I cycles
+
+// Settings the keys change, posted to the simulation thread when they do
+struct SimulationControls
+{
+	SimulationMode mode;
+	float theta;
+	IntegrationScheme scheme;
+	bool collide, sleep, emit;
+	float rate;
+	std::size_t burst;
+
+	bool operator==(const SimulationControls& o) const
+	{
+		return mode == o.mode && theta == o.theta && scheme == o.scheme && collide == o.collide && sleep == o.sleep
+			&& emit == o.emit && rate == o.rate && burst == o.burst;
+	}
+};
+
+//----BACKEND----
+enum class ComputeBackend { CPU, GPU };
+ComputeBackend computeBackend = ComputeBackend::CPU; // C toggles; the GPU only runs the uniform step
+
+//----COLLISIONS----
+bool logoCollision = true; // L toggles the particles bouncing off logo.stl
+bool particleSleep = true; // S toggles skipping the particles settled on the logo
+
+//----CULLING----
+bool frustumCulling = true; // V toggles
+
+//----CHECKPOINTS----
+const char* recordFile = "particles.glzp"; // R toggles recording every frame
+bool recording = false;
+bool recordQuantized = true;
+
+//----EMITTER----
+bool emitterOn = false; // E toggles, B bursts
+float emitterRate = 5000.f;
+std::size_t emitterBurst = 10000, pendingBurst = 0;
 
 double 
 	oldCursorX, oldCursorY,
@@ -75,6 +143,36 @@ static void key_callback(GLFWwindow* window, int key, int /*scancode*/, int acti
 {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GLFW_TRUE);
+
+	if (key == GLFW_KEY_G && action == GLFW_PRESS)
+		simulationMode = simulationMode == SimulationMode::BarnesHut ? SimulationMode::Uniform : SimulationMode::BarnesHut;
+
+	if (key == GLFW_KEY_F && action == GLFW_PRESS)
+		simulationMode = simulationMode == SimulationMode::Fluid ? SimulationMode::Uniform : SimulationMode::Fluid;
+
+	if (key == GLFW_KEY_E && action == GLFW_PRESS)
+		emitterOn = !emitterOn;
+
+	if (key == GLFW_KEY_B && action == GLFW_PRESS)
+		pendingBurst += emitterBurst;
+
+	if (key == GLFW_KEY_L && action == GLFW_PRESS)
+		logoCollision = !logoCollision;
+
+	if (key == GLFW_KEY_S && action == GLFW_PRESS)
+		particleSleep = !particleSleep;
+
+	if (key == GLFW_KEY_V && action == GLFW_PRESS)
+		frustumCulling = !frustumCulling;
+
+	if (key == GLFW_KEY_R && action == GLFW_PRESS)
+		recording = !recording;
+
+	if (key == GLFW_KEY_I && action == GLFW_PRESS)
+		integrationScheme = IntegrationScheme((int(integrationScheme) + 1) % 3);
+
+	if (key == GLFW_KEY_C && action == GLFW_PRESS)
+		computeBackend = computeBackend == ComputeBackend::GPU ? ComputeBackend::CPU : ComputeBackend::GPU;
 }
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
@@ -88,13 +186,6 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
 	phi += ypos * 0.0001f;
 }
 
-/* PARTICULES */
-struct Particule {
-	glm::vec4 position;
-	glm::vec4 color;
-	glm::vec4 speed;
-};
-
 /* POINTS */
 struct Vertex 
 {
@@ -102,42 +193,6 @@ struct Vertex
 	glm::vec2 uv;
 };
 
-std::vector<Particule> MakeParticules(const int n)
-{
-	std::default_random_engine generator;
-	std::uniform_real_distribution<float> distribution01(0, 1);
-	std::uniform_real_distribution<float> distributionWorld(-1, 1);
-	std::uniform_real_distribution<float> distributionMass(10, 100);
-
-	std::vector<Particule> p;
-	p.reserve(n);
-
-	for(int i = 0; i < n; i++)
-	{
-		float col = distribution01(generator);
-		p.push_back(Particule{
-				{ // pos
-					distributionWorld(generator),
-					distributionWorld(generator),
-					distributionWorld(generator),
-					distribution01(generator) * 100 // mass
-				}, 
-				{ // color
-					col, col, col,
-					1.f
-				},
-				{ // speed
-					0.f, 
-					0.f,
-					0.f,
-					1.f
-				},
-				});
-	}
-
-	return p;
-}
-
 GLuint MakeShader(GLuint t, std::string path)
 {
 	std::cout << path << std::endl;
@@ -206,21 +261,16 @@ void APIENTRY opengl_error_callback(GLenum source,
 	std::cout << message << std::endl;
 }
 
-glm::vec3 wrapAround(glm::vec3 pos)
+int main(int argc, char** argv)
 {
-	if (pos.x > 1.f) pos.x = -1.f;
-	if (pos.y > 1.f) pos.y = -1.f;
-	if (pos.z > 1.f) pos.z = -1.f;
-
-	if (pos.x < -1.f) pos.x = 1.f;
-	if (pos.y < -1.f) pos.y = 1.f;
-	if (pos.z < -1.f) pos.z = 1.f;
-
-	return pos;
-};
+	// --resume FILE: starts from the last frame of a recording
+	const char* resumeFile = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+			resumeFile = argv[++i];
+	}
 
-int main(void)
-{
 	glfwSetErrorCallback(error_callback);
 
 	if (!glfwInit())
@@ -308,7 +358,43 @@ int main(void)
 	// - End Cube
 
 	// - Particules
-	std::vector<Particule> particules = MakeParticules(nParticules);
+	// The simulation thread and the render thread both run jobs while they wait,
+	// each on its own pool so that a frame never waits on simulation jobs
+	const unsigned cores = std::thread::hardware_concurrency();
+	if (workerThreads == 0)
+		workerThreads = cores > renderWorkers + 3 ? cores - renderWorkers - 2 : 1;
+	JobSystem jobs(workerThreads, pinWorkers);
+	JobSystem renderJobs(renderWorkers);
+	ParticleStore particules = MakeParticules(nParticules, particuleCapacity, &jobs);
+
+	if (resumeFile)
+	{
+		CheckpointReader reader;
+		if (reader.Open(resumeFile) && reader.FrameCount() > 0 && reader.Load(reader.FrameCount() - 1, particules, jobs))
+			std::cout << "Resumed " << particules.Size() << " particles from " << resumeFile << std::endl;
+		else
+			std::cerr << "Cannot resume from " << resumeFile << std::endl;
+	}
+
+	CheckpointRecorder recorder;
+	recorder.quantize = recordQuantized;
+
+	IntegrateKernel integrate = SelectIntegrator();
+	if (!VerifyIntegrator(integrate))
+	{
+		std::cerr << IntegratorName(integrate) << " integrator differs from the scalar reference" << std::endl;
+		integrate = IntegrateScalar;
+	}
+	std::cout << "Integrator: " << IntegratorName(integrate) << std::endl;
+
+	Simulation simulation(particules, jobs);
+	simulation.settings.integrate = integrate;
+	simulation.settings.chunk = particuleChunk;
+	simulation.Fluid().Reserve(particules.Capacity());
+	simulation.timestep.step = simulationStep;
+	simulation.timestep.maxSubsteps = maxSubsteps;
+	// The logo lies flat in the lower half of the cube, for the particles to fall on
+	simulation.collider.Build(triangles, LayMeshFlat(triangles, 1.6f, -0.4f));
 	// - End Particules
 
 	// Textures
@@ -327,28 +413,57 @@ int main(void)
 	glTextureStorage2D(frameDepthTextureID, 1, GL_DEPTH_COMPONENT16, frameWidth, frameHeight);
 
 	// Buffers
-	GLuint vbo, vao;
-	glGenBuffers(1, &vbo);
-	glGenVertexArrays(1, &vao);
+	// One region per frame in flight, each large enough for every particle
+	// in the packed layout
+	UploadRing ring;
+	ring.Create(particules.Capacity() * sizeof(PackedParticule));
+	const GLuint vbo = ring.Buffer();
 
-	glBindVertexArray(vao);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, particules.size() * sizeof(Particule), particules.data(), GL_STATIC_DRAW);
+	// The GPU backend steps and draws the same storage buffer
+	GpuParticles gpuParticules;
+	gpuParticules.Create(programCompute, particules.Capacity());
 
-	// Bindings
+	// One vertex array per backend: packed particles from the ring, full ones from the SSBO
 	const auto indexPos = glGetAttribLocation(programDisplay, "position");
+	const auto indexCol = glGetAttribLocation(programDisplay, "color");
+
+	GLuint vaos[2];
+	glGenVertexArrays(2, vaos);
+
+	glBindVertexArray(vaos[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	// Bindings, normalized: the shader receives positions in [-1, 1] and colors in [0, 1]
+	glVertexAttribPointer(indexPos, 3, GL_SHORT, GL_TRUE, sizeof(PackedParticule), nullptr);
+	glEnableVertexAttribArray(indexPos);
+
+	glVertexAttribPointer(indexCol, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedParticule), (void*)6);
+	glEnableVertexAttribArray(indexCol);
+
+	glBindVertexArray(vaos[1]);
+	glBindBuffer(GL_ARRAY_BUFFER, gpuParticules.Buffer());
+
 	glVertexAttribPointer(indexPos, 3, GL_FLOAT, GL_FALSE, sizeof(Particule), nullptr);
 	glEnableVertexAttribArray(indexPos);
 
-	const auto indexCol = glGetAttribLocation(programDisplay, "color");
 	glVertexAttribPointer(indexCol, 4, GL_FLOAT, GL_FALSE, sizeof(Particule), (void*)16);
 	glEnableVertexAttribArray(indexCol);
+	ComputeBackend activeBackend = ComputeBackend::CPU;
+
+	// Only the particles in view are copied to the ring and drawn
+	FrustumCuller culler;
+	if (!VerifyCuller(culler.kernel))
+	{
+		std::cerr << CullerName(culler.kernel) << " culler differs from the scalar reference" << std::endl;
+		culler.kernel = CullScalar;
+	}
+	std::size_t drawCount = 0;
+	std::cout << "Culler: " << CullerName(culler.kernel) << std::endl;
 
 	// Uniforms
 	int uniformLookAt = glGetUniformLocation(programDisplay, "lookAt");
 	int uniformPers = glGetUniformLocation(programDisplay, "perspective");
 	int uniformTransform = glGetUniformLocation(programDisplay, "transformMatrix");
-	int uniformDt = glGetUniformLocation(programCompute, "dt");
 
 	// Frame buffers
 	GLenum gl_color_attachment0[] = { GL_COLOR_ATTACHMENT0 };
@@ -401,6 +516,13 @@ int main(void)
 	glPointSize(2.f);
 	glEnable(GL_DEPTH_TEST);
 
+	// The particles now belong to the simulation thread, except while it is paused
+	SimulationThread simThread(simulation, particules, jobs);
+	simThread.realTime = realTime;
+	simThread.Start();
+	SimulationControls controls = {};
+	std::size_t repeatedFrames = 0; // frames drawn without a new state
+
 	float time = glfwGetTime();
 	int frame = 0;
 	float timeSum = 0;
@@ -411,18 +533,87 @@ int main(void)
 		timeSum += dt;
 		if (frame == 1000) 
 		{
-			std::cout << 1 / (timeSum / 1000) << std::endl;
+			const SimulationStats& stats = simThread.Latest().stats;
+			std::cout << 1 / (timeSum / 1000) << " fps (" << repeatedFrames / 10.0 << "% without a new state), "
+				<< stats.stepsPerSecond << " steps/s (" << stats.stepMs << " ms/step, " << stats.publishMs << " ms/snapshot), "
+				<< stats.steps << " steps, " << stats.droppedTime << " s dropped, "
+				<< stats.reorders << " reorders (disorder " << stats.disorderBefore
+				<< " -> " << stats.disorderAfter << "), " << stats.contacts << " contacts, "
+				<< stats.sleeping << " sleeping, "
+				<< ring.Stalls() << " upload stalls, " << recorder.Frames() << " frames recorded ("
+				<< recorder.Waits() << " waits), " << culler.Stats().visible << "/" << culler.Stats().tested << " visible ("
+				<< culler.Stats().bytesSaved / (1024 * 1024) << " MB upload saved), " << SchemeName(integrationScheme)
+				<< " energy drift " << stats.energyDrift << std::endl;
 			frame = 0;
 			timeSum = 0;
+			repeatedFrames = 0;
+
+			// Measured between two batches, reported with the next state
+			simThread.Post([](Simulation& s) { s.energy.Sample(s.MeasureEnergy()); });
+		}
+
+		// Switching backend moves the particles to the side that steps them.
+		// The simulation thread stays paused while the GPU runs.
+		if (computeBackend != activeBackend)
+		{
+			if (computeBackend == ComputeBackend::GPU)
+			{
+				simThread.Pause();
+				gpuParticules.Upload(particules);
+			}
+			else
+			{
+				gpuParticules.Download(particules);
+				particules.SavePositions(0, particules.Size());
+				simulation.InvalidateForces();
+				simulation.sleep.WakeAll(particules, jobs);
+				simThread.Resume();
+			}
+			activeBackend = computeBackend;
+		}
+
+		if (recording != recorder.IsOpen())
+		{
+			simThread.Pause();
+			if (recording)
+				recording = recorder.Open(recordFile);
+			else
+				recorder.Close();
+			simThread.SetRecorder(recorder.IsOpen() ? &recorder : nullptr);
+			simThread.Resume();
+		}
+		const bool gpu = activeBackend == ComputeBackend::GPU;
+
+		// Key changes reach the simulation thread between two batches
+		const SimulationControls wanted = { simulationMode, octreeTheta, integrationScheme, logoCollision, particleSleep,
+			emitterOn || pendingBurst > 0, emitterOn ? emitterRate : 0.f, pendingBurst };
+		if (!(wanted == controls))
+		{
+			simThread.Post([wanted](Simulation& s) {
+				s.settings.mode = wanted.mode;
+				s.settings.theta = wanted.theta;
+				s.settings.scheme = wanted.scheme;
+				s.settings.collide = wanted.collide;
+				s.settings.sleep = wanted.sleep;
+				// Once mortal particles exist they must keep ageing, so this stays on
+				s.settings.emit = s.settings.emit || wanted.emit;
+				s.emitter.rate = wanted.rate;
+				s.emitter.Burst(wanted.burst);
+			});
+			controls = wanted;
+			controls.burst = 0;
 		}
+		pendingBurst = 0;
 
-		// GPU compute shaders
-		/*glUseProgram(programCompute);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo);
-		glDispatchCompute(nParticules / 32, 1, 1);
-		glMemoryBarrier(GL_ALL_BARRIER_BITS);*/
+		if (gpu)
+		{
+			// GPU compute shaders, on the same fixed step as the CPU (no interpolation)
+			const int steps = simulation.timestep.Advance(dt);
+			for (int s = 0; s < steps; s++)
+				gpuParticules.Step(particules.Size(), float(simulation.timestep.step));
+		}
 
-		glBindVertexArray(vao);
+		glBindVertexArray(vaos[gpu ? 1 : 0]);
 		glUseProgram(programDisplay);
 
 		glfwGetFramebufferSize(window, &width, &height);
@@ -463,33 +654,61 @@ int main(void)
 			transformMatrix = rotationMatrix * translateMatrix * scaleMatrix;
 			//--------------------------
 
-			// Compute with CPU
-			float g = -9.81f;
-			for (int i = 0; i < nParticules; i++) 
+			if (!gpu)
 			{
-				glm::vec3 accel = particules[i].position.w * g * glm::vec3(0.f, 0.1f, 0.f);
-				particules[i].speed += glm::vec4(accel * float(dt), particules[i].speed.w);
-				particules[i].position += glm::vec4(particules[i].speed.x * dt, particules[i].speed.y * dt, particules[i].speed.z * dt, 0.f);
-				particules[i].position = glm::vec4(wrapAround(particules[i].position), particules[i].position.w);
+				// Latest state of the simulation thread, which keeps stepping meanwhile
+				if (!simThread.Update())
+					repeatedFrames++;
+				const ParticleSnapshot& snapshot = simThread.Latest();
+				const DrawableParticles& drawn = snapshot.particles;
+
+				// Pack straight into the mapped region the GPU is done with
+				const std::size_t n = drawn.Size();
+				const float alpha = snapshot.Alpha(std::chrono::steady_clock::now());
+				auto mapped = (PackedParticule*) ring.Begin();
+				if (frustumCulling)
+				{
+					// Same matrices as shader.vert, which does not apply lookAt
+					drawCount = culler.Cull(drawn, perspective * transformMatrix, alpha, mapped, renderJobs);
+				}
+				else
+				{
+					renderJobs.ParallelFor(0, n, JobSystem::SimdChunk(particuleChunk),
+						[&drawn, mapped, alpha](std::size_t b, std::size_t e) { drawn.Pack(mapped + b, b, e - b, alpha); });
+					drawCount = n;
+				}
 			}
-			glBufferSubData(GL_ARRAY_BUFFER, 0, nParticules * sizeof(Particule), particules.data());
-
 		}
 
 		glProgramUniformMatrix4fv(programDisplay, uniformLookAt, 1, GL_FALSE, &lookAt[0][0]);
 		glProgramUniformMatrix4fv(programDisplay, uniformPers, 1, GL_FALSE, &perspective[0][0]);
 		glProgramUniformMatrix4fv(programDisplay, uniformTransform, 1, GL_FALSE, &transformMatrix[0][0]);
-		glProgramUniform1f(programCompute, uniformDt, dt);
 
 		time = frameTime;
 		frame++;
 
 
-		glDrawArrays(GL_POINTS, 0, particules.size());
+		if (gpu)
+			glDrawArrays(GL_POINTS, 0, GLsizei(particules.Size()));
+		else
+		{
+			glDrawArrays(GL_POINTS, GLint(ring.Offset() / sizeof(PackedParticule)), GLsizei(drawCount));
+			ring.End();
+		}
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+
+		// Render rate cap, independent of the simulation thread
+		if (maxFrameRate > 0.0)
+		{
+			const double wait = frameTime + 1.0 / maxFrameRate - glfwGetTime();
+			if (wait > 0.0)
+				std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+		}
 	}
+	simThread.Stop();
+	recorder.Close();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
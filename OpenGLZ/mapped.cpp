@@ -0,0 +1,92 @@
+#include "mapped.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+
+#if defined(_WIN32)
+	HANDLE f = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(f, &length))
+	{
+		CloseHandle(f);
+		return false;
+	}
+	file = f;
+	size = std::size_t(length.QuadPart);
+	open = true;
+	if (size == 0)
+		return true;
+
+	mapping = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping)
+		data = (const char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	const int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+	size = std::size_t(info.st_size);
+	open = true;
+	if (size == 0)
+	{
+		::close(fd);
+		return true;
+	}
+
+	// The mapping keeps its own reference to the file
+	void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view != MAP_FAILED)
+	{
+		madvise(view, size, MADV_SEQUENTIAL);
+		data = (const char*) view;
+	}
+#endif
+
+	if (!data)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+#if defined(_WIN32)
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+	mapping = nullptr;
+	file = nullptr;
+#else
+	if (data)
+		munmap((void*) data, size);
+#endif
+	data = nullptr;
+	size = 0;
+	open = false;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. The pages are loaded by the OS on
+// first access, so opening is cheap and reading runs at disk (or cache) speed.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// False when the file cannot be opened or mapped; an empty file maps to no data
+	bool Open(const char* filename);
+	void Close();
+
+	bool IsOpen() const { return open; }
+	const char* Data() const { return data; }
+	std::size_t Size() const { return size; }
+
+private:
+	const char* data = nullptr;
+	std::size_t size = 0;
+	bool open = false;
+#if defined(_WIN32)
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+
+// Helpers shared by the mesh readers and the weld: the text scanning of the
+// ASCII STL and OBJ parsers, and the hash of the integer triples their hash
+// tables are keyed by.
+
+inline bool IsBlank(char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+}
+
+inline void SkipBlanks(const char*& at, const char* end)
+{
+	while (at < end && IsBlank(*at))
+		at++;
+}
+
+// Skips the blanks before the number: from_chars takes neither them nor a plus sign
+inline bool ParseFloat(const char*& at, const char* end, float& value)
+{
+	SkipBlanks(at, end);
+	if (at < end && *at == '+')
+		at++;
+	const std::from_chars_result r = std::from_chars(at, end, value);
+	if (r.ec != std::errc())
+		return false;
+	at = r.ptr;
+	return true;
+}
+
+// Mixes three 32-bit words, for open addressing tables masked to a power of two
+inline std::size_t HashTriple(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	std::uint64_t h = x * 0x9e3779b97f4a7c15ull;
+	h ^= (h >> 29) ^ y * 0xbf58476d1ce4e5b9ull;
+	h ^= (h >> 32) ^ z * 0x94d049bb133111ebull;
+	return std::size_t(h ^ (h >> 31));
+}
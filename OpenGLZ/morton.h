@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// 30-bit Morton codes over the [-1, 1] cube, 10 bits per axis.
+// Bits are interleaved as ...x1y1z1x0y0z0, so the 3-bit digit at level L
+// (shift 27 - 3L) selects the octant of a cell of edge 2 / 2^L.
+
+constexpr unsigned MortonBits = 30;
+constexpr unsigned MortonLevels = 10;
+
+// Spreads the low 10 bits of v so that there are two zeros between each bit
+inline std::uint32_t MortonExpand(std::uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+// Grid coordinate in [0, 1023] of a position in [-1, 1]
+inline std::uint32_t MortonQuantize(float x)
+{
+	const float q = (x + 1.f) * 512.f;
+	if (!(q > 0.f))
+		return 0;
+	return q >= 1023.f ? 1023u : std::uint32_t(q);
+}
+
+inline std::uint32_t MortonCode(float x, float y, float z)
+{
+	return (MortonExpand(MortonQuantize(x)) << 2)
+		| (MortonExpand(MortonQuantize(y)) << 1)
+		| MortonExpand(MortonQuantize(z));
+}
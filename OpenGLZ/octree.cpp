@@ -0,0 +1,308 @@
+#include "octree.h"
+
+#include "morton.h"
+#include "sort.h"
+
+#include <algorithm>
+#include <cmath>
+
+static std::uint32_t digitAt(std::uint32_t code, unsigned level)
+{
+	return (code >> (MortonBits - 3 * (level + 1))) & 7;
+}
+
+void Octree::Build(const ParticleStore& p, JobSystem& jobs)
+{
+	const std::size_t n = p.Size();
+
+	codes.resize(n);
+	order.resize(n);
+	tmpCodes.resize(n);
+	tmpOrder.resize(n);
+	sx.resize(n);
+	sy.resize(n);
+	sz.resize(n);
+	sm.resize(n);
+	nodes.clear();
+
+	jobs.ParallelFor(0, n, 0, [&](std::size_t b, std::size_t e) {
+		for (std::size_t i = b; i < e; i++)
+		{
+			codes[i] = MortonCode(p.px[i], p.py[i], p.pz[i]);
+			order[i] = std::uint32_t(i);
+		}
+	});
+
+	RadixSortPairs(codes.data(), order.data(), tmpCodes.data(), tmpOrder.data(), n, MortonBits, jobs);
+
+	jobs.ParallelFor(0, n, 0, [&](std::size_t b, std::size_t e) {
+		for (std::size_t i = b; i < e; i++)
+		{
+			const auto j = order[i];
+			sx[i] = p.px[j];
+			sy[i] = p.py[j];
+			sz[i] = p.pz[j];
+			sm[i] = p.mass[j];
+		}
+	});
+
+	nodes.push_back({});
+	OctreeNode& root = nodes[0];
+	root.size = 2.f;
+	root.first = 0;
+	root.count = std::uint32_t(n);
+	root.childCount = 0;
+
+	if (n <= leafSize)
+	{
+		leafMoments(root);
+		return;
+	}
+
+	// Ranges of the root children, the codes being sorted
+	std::uint32_t childFirst[8], childCount[8];
+	unsigned k = 0;
+	for (std::uint32_t d = 0, begin = 0; d < 8; d++)
+	{
+		const auto end = std::uint32_t(std::partition_point(codes.begin() + begin, codes.end(),
+			[d](std::uint32_t c) { return digitAt(c, 0) <= d; }) - codes.begin());
+		if (end > begin)
+		{
+			childFirst[k] = begin;
+			childCount[k] = end - begin;
+			k++;
+		}
+		begin = end;
+	}
+
+	// Every subtree is built in its own array, with its root at index 0
+	std::vector<OctreeNode> subtrees[8];
+	jobs.ParallelFor(0, k, 1, [&](std::size_t b, std::size_t e) {
+		for (std::size_t j = b; j < e; j++)
+		{
+			const auto d = digitAt(codes[childFirst[j]], 0);
+			subtrees[j].push_back({});
+			buildNode(subtrees[j], 0, childFirst[j], childCount[j], 1,
+				d & 4 ? 0.f : -1.f, d & 2 ? 0.f : -1.f, d & 1 ? 0.f : -1.f);
+		}
+	});
+
+	// Layout: root, the k subtree roots, then the rest of each subtree
+	std::uint32_t base[8];
+	std::uint32_t total = 1 + k;
+	for (unsigned j = 0; j < k; j++)
+	{
+		base[j] = total;
+		total += std::uint32_t(subtrees[j].size() - 1);
+	}
+
+	nodes.resize(total);
+	nodes[0].firstChild = 1;
+	nodes[0].childCount = k;
+
+	jobs.ParallelFor(0, k, 1, [&](std::size_t b, std::size_t e) {
+		for (std::size_t j = b; j < e; j++)
+		{
+			const auto& sub = subtrees[j];
+			for (std::size_t l = 0; l < sub.size(); l++)
+			{
+				OctreeNode node = sub[l];
+				if (node.childCount > 0)
+					node.firstChild = base[j] + node.firstChild - 1;
+				nodes[l == 0 ? 1 + j : base[j] + l - 1] = node;
+			}
+		}
+	});
+
+	OctreeNode& top = nodes[0];
+	float mx = 0.f, my = 0.f, mz = 0.f, m = 0.f;
+	for (unsigned j = 0; j < k; j++)
+	{
+		const OctreeNode& c = nodes[1 + j];
+		mx += c.x * c.mass;
+		my += c.y * c.mass;
+		mz += c.z * c.mass;
+		m += c.mass;
+	}
+	top.mass = m;
+	top.x = m > 0.f ? mx / m : 0.f;
+	top.y = m > 0.f ? my / m : 0.f;
+	top.z = m > 0.f ? mz / m : 0.f;
+}
+
+void Octree::buildNode(std::vector<OctreeNode>& out, std::uint32_t index, std::uint32_t first, std::uint32_t count,
+	unsigned level, float x, float y, float z) const
+{
+	const float size = 2.f / float(1u << level);
+	{
+		OctreeNode& node = out[index];
+		node.size = size;
+		node.first = first;
+		node.count = count;
+		node.firstChild = node.childCount = 0;
+
+		if (count <= leafSize || level == MortonLevels)
+		{
+			node.x = x + size * 0.5f;
+			node.y = y + size * 0.5f;
+			node.z = z + size * 0.5f;
+			leafMoments(node);
+			return;
+		}
+	}
+
+	std::uint32_t childFirst[8], childCount[8], childDigit[8];
+	unsigned k = 0;
+	const auto last = codes.begin() + first + count;
+	for (std::uint32_t d = 0, begin = first; d < 8; d++)
+	{
+		const auto end = std::uint32_t(std::partition_point(codes.begin() + begin, last,
+			[d, level](std::uint32_t c) { return digitAt(c, level) <= d; }) - codes.begin());
+		if (end > begin)
+		{
+			childFirst[k] = begin;
+			childCount[k] = end - begin;
+			childDigit[k] = d;
+			k++;
+		}
+		begin = end;
+	}
+
+	// Children are allocated together, then filled depth first
+	const auto firstChild = std::uint32_t(out.size());
+	out.resize(out.size() + k);
+	out[index].firstChild = firstChild;
+	out[index].childCount = k;
+
+	const float half = size * 0.5f;
+	float mx = 0.f, my = 0.f, mz = 0.f, m = 0.f;
+	for (unsigned j = 0; j < k; j++)
+	{
+		const auto d = childDigit[j];
+		buildNode(out, firstChild + j, childFirst[j], childCount[j], level + 1,
+			d & 4 ? x + half : x, d & 2 ? y + half : y, d & 1 ? z + half : z);
+
+		const OctreeNode& c = out[firstChild + j];
+		mx += c.x * c.mass;
+		my += c.y * c.mass;
+		mz += c.z * c.mass;
+		m += c.mass;
+	}
+
+	OctreeNode& node = out[index];
+	node.mass = m;
+	if (m > 0.f)
+	{
+		node.x = mx / m;
+		node.y = my / m;
+		node.z = mz / m;
+	}
+	else
+	{
+		node.x = x + half;
+		node.y = y + half;
+		node.z = z + half;
+	}
+}
+
+void Octree::leafMoments(OctreeNode& node) const
+{
+	float mx = 0.f, my = 0.f, mz = 0.f, m = 0.f;
+	for (std::uint32_t i = node.first; i < node.first + node.count; i++)
+	{
+		mx += sx[i] * sm[i];
+		my += sy[i] * sm[i];
+		mz += sz[i] * sm[i];
+		m += sm[i];
+	}
+
+	// A massless cell keeps the position it was given
+	node.mass = m;
+	if (m > 0.f)
+	{
+		node.x = mx / m;
+		node.y = my / m;
+		node.z = mz / m;
+	}
+}
+
+void Octree::Accelerations(float G, float* ax, float* ay, float* az, JobSystem& jobs) const
+{
+	walk<false>(G, ax, ay, az, nullptr, jobs);
+}
+
+void Octree::Accelerations(float G, float* ax, float* ay, float* az, float* phi, JobSystem& jobs) const
+{
+	walk<true>(G, ax, ay, az, phi, jobs);
+}
+
+template<bool Potential>
+void Octree::walk(float G, float* ax, float* ay, float* az, float* phi, JobSystem& jobs) const
+{
+	const float theta2 = theta * theta;
+	const float eps2 = softening * softening;
+
+	// Walk the particles in Morton order: neighbours open the same cells
+	jobs.ParallelFor(0, sx.size(), 0, [&](std::size_t b, std::size_t e) {
+		std::uint32_t stack[8 * (MortonLevels + 2)];
+
+		for (std::size_t i = b; i < e; i++)
+		{
+			const float x = sx[i], y = sy[i], z = sz[i];
+			float fx = 0.f, fy = 0.f, fz = 0.f, pot = 0.f;
+
+			int top = 0;
+			stack[top++] = 0;
+			while (top > 0)
+			{
+				const OctreeNode& node = nodes[stack[--top]];
+				const float dx = node.x - x;
+				const float dy = node.y - y;
+				const float dz = node.z - z;
+				const float d2 = dx * dx + dy * dy + dz * dz;
+
+				if (node.childCount > 0 && node.size * node.size >= theta2 * d2)
+				{
+					for (std::uint32_t c = 0; c < node.childCount; c++)
+						stack[top++] = node.firstChild + c;
+				}
+				else if (node.childCount > 0 || node.count == 0)
+				{
+					const float r2 = d2 + eps2;
+					const float inv = 1.f / std::sqrt(r2);
+					const float s = node.mass * inv * inv * inv;
+					fx += dx * s;
+					fy += dy * s;
+					fz += dz * s;
+					if (Potential)
+						pot += node.mass * inv;
+				}
+				else
+				{
+					// Leaf: direct sum, the particle itself adds nothing (dx = 0)
+					for (std::uint32_t j = node.first; j < node.first + node.count; j++)
+					{
+						const float px = sx[j] - x;
+						const float py = sy[j] - y;
+						const float pz = sz[j] - z;
+						const float r2 = px * px + py * py + pz * pz + eps2;
+						const float inv = 1.f / std::sqrt(r2);
+						const float s = sm[j] * inv * inv * inv;
+						fx += px * s;
+						fy += py * s;
+						fz += pz * s;
+						if (Potential && j != i)
+							pot += sm[j] * inv;
+					}
+				}
+			}
+
+			const auto j = order[i];
+			ax[j] = G * fx;
+			ay[j] = G * fy;
+			az[j] = G * fz;
+			if (Potential)
+				phi[j] = -G * pot;
+		}
+	});
+}
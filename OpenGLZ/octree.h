@@ -0,0 +1,50 @@
+#pragma once
+
+#include "jobs.h"
+#include "particles.h"
+
+#include <cstdint>
+#include <vector>
+
+struct OctreeNode
+{
+	float x, y, z, mass; // center of mass and total mass
+	float size; // edge length of the cell
+	std::uint32_t firstChild, childCount; // children are contiguous, none for a leaf
+	std::uint32_t first, count; // particles of the cell, in Morton order
+};
+
+// Barnes-Hut octree over the [-1, 1] cube.
+// Build sorts the particles by Morton code, so every cell is a contiguous
+// range of the sorted particles, and lays out the nodes top-down with the
+// eight subtrees of the root built in parallel.
+class Octree
+{
+public:
+	float theta = 0.5f; // opening angle: a cell of edge s at distance d is used whole when s / d < theta
+	float softening = 0.01f;
+	unsigned leafSize = 8;
+
+	void Build(const ParticleStore& p, JobSystem& jobs);
+
+	// Gravitational acceleration G * sum(m / r^2) felt by every particle, in store order.
+	// Periodic images of the wrapped domain are ignored.
+	void Accelerations(float G, float* ax, float* ay, float* az, JobSystem& jobs) const;
+
+	// Same walk, also writing the potential -G * sum(m / r) of every particle
+	// (itself excluded) to phi, for energy diagnostics
+	void Accelerations(float G, float* ax, float* ay, float* az, float* phi, JobSystem& jobs) const;
+
+	const std::vector<OctreeNode>& Nodes() const { return nodes; }
+
+private:
+	void buildNode(std::vector<OctreeNode>& out, std::uint32_t index, std::uint32_t first, std::uint32_t count,
+		unsigned level, float x, float y, float z) const;
+	void leafMoments(OctreeNode& node) const;
+	template<bool Potential>
+	void walk(float G, float* ax, float* ay, float* az, float* phi, JobSystem& jobs) const;
+
+	std::vector<std::uint32_t> codes, order, tmpCodes, tmpOrder;
+	std::vector<float> sx, sy, sz, sm;
+	std::vector<OctreeNode> nodes;
+};
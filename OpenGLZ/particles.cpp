@@ -0,0 +1,254 @@
+#include "particles.h"
+
+#include "jobs.h"
+#include "random.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+ParticleStore::ParticleStore(std::size_t capacity)
+	: px(capacity), py(capacity), pz(capacity), mass(capacity),
+	vx(capacity), vy(capacity), vz(capacity),
+	color(capacity),
+	life(capacity),
+	rest(capacity),
+	prevX(capacity), prevY(capacity), prevZ(capacity),
+	capacity(capacity)
+{
+}
+
+DrawableParticles::DrawableParticles(std::size_t capacity)
+	: px(capacity), py(capacity), pz(capacity), mass(capacity),
+	color(capacity),
+	prevX(capacity), prevY(capacity), prevZ(capacity),
+	capacity(capacity)
+{
+}
+
+std::size_t ParticleStore::Spawn(std::size_t n)
+{
+	const std::size_t first = count;
+	const std::size_t spawned = std::min(n, capacity - count);
+
+	for (std::size_t i = first; i < first + spawned; i++)
+	{
+		px[i] = py[i] = pz[i] = mass[i] = 0.f;
+		vx[i] = vy[i] = vz[i] = 0.f;
+		color[i] = glm::vec4(0.f);
+		life[i] = std::numeric_limits<float>::infinity();
+		rest[i] = 0.f;
+		prevX[i] = prevY[i] = prevZ[i] = 0.f;
+	}
+
+	count += spawned;
+	return first;
+}
+
+void ParticleStore::Kill(std::vector<std::size_t> indices)
+{
+	// Highest indices first, so a particle moved from the end is never one to kill
+	std::sort(indices.begin(), indices.end(), std::greater<std::size_t>());
+	indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+	for (const auto i : indices)
+	{
+		if (i >= count)
+			continue;
+
+		count--;
+		if (i != count)
+			Move(count, i);
+	}
+}
+
+std::size_t ParticleStore::KillExpired()
+{
+	std::size_t killed = 0;
+	std::size_t i = 0;
+	while (i < count)
+	{
+		if (life[i] > 0.f)
+		{
+			i++;
+			continue;
+		}
+
+		// The particle moved in is tested on the next iteration
+		count--;
+		killed++;
+		if (i != count)
+			Move(count, i);
+	}
+	return killed;
+}
+
+void ParticleStore::Move(std::size_t from, std::size_t to)
+{
+	ForEachField([from, to](auto& field) { field[to] = field[from]; });
+}
+
+void ParticleStore::Swap(std::size_t a, std::size_t b)
+{
+	ForEachField([a, b](auto& field) { std::swap(field[a], field[b]); });
+}
+
+void DrawableParticles::Copy(const ParticleStore& from, std::size_t first, std::size_t n)
+{
+	const std::size_t bytes = n * sizeof(float);
+	std::memcpy(&px[first], &from.px[first], bytes);
+	std::memcpy(&py[first], &from.py[first], bytes);
+	std::memcpy(&pz[first], &from.pz[first], bytes);
+	std::memcpy(&prevX[first], &from.prevX[first], bytes);
+	std::memcpy(&prevY[first], &from.prevY[first], bytes);
+	std::memcpy(&prevZ[first], &from.prevZ[first], bytes);
+	std::memcpy(&mass[first], &from.mass[first], bytes);
+	std::memcpy(&color[first], &from.color[first], n * sizeof(glm::vec4));
+}
+
+void ParticleStore::SavePositions(std::size_t first, std::size_t n)
+{
+	std::copy(&px[first], &px[first] + n, &prevX[first]);
+	std::copy(&py[first], &py[first] + n, &prevY[first]);
+	std::copy(&pz[first], &pz[first] + n, &prevZ[first]);
+}
+
+static float blend(float previous, float current, float alpha)
+{
+	// A jump of more than half the domain is a wrap around, not a motion
+	const float d = current - previous;
+	return d > 1.f || d < -1.f ? current : previous + d * alpha;
+}
+
+void ParticleStore::Interleave(Particule* out, std::size_t first, std::size_t n, float alpha) const
+{
+	if (alpha >= 1.f)
+	{
+		for (std::size_t i = first; i < first + n; i++, out++)
+		{
+			out->position = glm::vec4(px[i], py[i], pz[i], mass[i]);
+			out->color = color[i];
+			out->speed = glm::vec4(vx[i], vy[i], vz[i], 1.f);
+		}
+		return;
+	}
+
+	for (std::size_t i = first; i < first + n; i++, out++)
+	{
+		out->position = glm::vec4(
+			blend(prevX[i], px[i], alpha),
+			blend(prevY[i], py[i], alpha),
+			blend(prevZ[i], pz[i], alpha),
+			mass[i]);
+		out->color = color[i];
+		out->speed = glm::vec4(vx[i], vy[i], vz[i], 1.f);
+	}
+}
+
+void DrawableParticles::InterleaveIndexed(Particule* out, const std::uint32_t* indices, std::size_t n, float alpha) const
+{
+	for (std::size_t k = 0; k < n; k++, out++)
+	{
+		const std::uint32_t i = indices[k];
+		out->position = glm::vec4(
+			blend(prevX[i], px[i], alpha),
+			blend(prevY[i], py[i], alpha),
+			blend(prevZ[i], pz[i], alpha),
+			mass[i]);
+		out->color = color[i];
+		out->speed = glm::vec4(0.f, 0.f, 0.f, 1.f);
+	}
+}
+
+static inline std::int16_t snorm16(float x)
+{
+	x = x > 1.f ? 1.f : x;
+	x = x < -1.f ? -1.f : x;
+	return std::int16_t(x * 32767.f + (x < 0.f ? -0.5f : 0.5f));
+}
+
+static inline std::uint8_t unorm8(float x)
+{
+	x = x > 1.f ? 1.f : x;
+	x = x < 0.f ? 0.f : x;
+	return std::uint8_t(x * 255.f + 0.5f);
+}
+
+static inline void pack(PackedParticule* out, float x, float y, float z, const glm::vec4& c)
+{
+	out->position[0] = snorm16(x);
+	out->position[1] = snorm16(y);
+	out->position[2] = snorm16(z);
+	out->color[0] = unorm8(c.r);
+	out->color[1] = unorm8(c.g);
+	out->color[2] = unorm8(c.b);
+	out->color[3] = unorm8(c.a);
+}
+
+void DrawableParticles::Pack(PackedParticule* out, std::size_t first, std::size_t n, float alpha) const
+{
+	if (alpha >= 1.f)
+	{
+		for (std::size_t i = first; i < first + n; i++, out++)
+			pack(out, px[i], py[i], pz[i], color[i]);
+		return;
+	}
+
+	for (std::size_t i = first; i < first + n; i++, out++)
+		pack(out, blend(prevX[i], px[i], alpha), blend(prevY[i], py[i], alpha), blend(prevZ[i], pz[i], alpha), color[i]);
+}
+
+void DrawableParticles::PackIndexed(PackedParticule* out, const std::uint32_t* indices, std::size_t n, float alpha) const
+{
+	for (std::size_t k = 0; k < n; k++, out++)
+	{
+		const std::uint32_t i = indices[k];
+		pack(out, blend(prevX[i], px[i], alpha), blend(prevY[i], py[i], alpha), blend(prevZ[i], pz[i], alpha), color[i]);
+	}
+}
+
+void ParticleStore::Deinterleave(const Particule* in, std::size_t first, std::size_t n)
+{
+	for (std::size_t i = first; i < first + n; i++, in++)
+	{
+		px[i] = in->position.x;
+		py[i] = in->position.y;
+		pz[i] = in->position.z;
+		mass[i] = in->position.w;
+		color[i] = in->color;
+		vx[i] = in->speed.x;
+		vy[i] = in->speed.y;
+		vz[i] = in->speed.z;
+	}
+}
+
+void RandomizeParticules(ParticleStore& p, std::size_t first, std::size_t n, std::uint64_t seed)
+{
+	for (std::size_t i = first; i < first + n; i++)
+	{
+		const Philox4x32 r0 = RandomBlock(seed, RandomStream::Init, i, 0);
+		const Philox4x32 r1 = RandomBlock(seed, RandomStream::Init, i, 1);
+
+		const float col = RandomUnit(r0.v[0]);
+		p.color[i] = { col, col, col, 1.f };
+
+		p.px[i] = p.prevX[i] = RandomRange(r0.v[1], -1.f, 1.f);
+		p.py[i] = p.prevY[i] = RandomRange(r0.v[2], -1.f, 1.f);
+		p.pz[i] = p.prevZ[i] = RandomRange(r0.v[3], -1.f, 1.f);
+		p.mass[i] = RandomUnit(r1.v[0]) * 100;
+	}
+}
+
+ParticleStore MakeParticules(const int n, std::size_t capacity, JobSystem* jobs, std::uint64_t seed)
+{
+	ParticleStore p(std::max<std::size_t>(n, capacity));
+	p.Spawn(n);
+
+	if (jobs)
+		jobs->ParallelFor(0, n, 0, [&p, seed](std::size_t b, std::size_t e) { RandomizeParticules(p, b, e - b, seed); });
+	else
+		RandomizeParticules(p, 0, n, seed);
+
+	return p;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <glm/vec4.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* PARTICULES */
+// Interleaved layout of the particle VBO (also the std430 layout of shader.comp)
+struct Particule {
+	glm::vec4 position;
+	glm::vec4 color;
+	glm::vec4 speed;
+};
+
+// Packed layout of the displayed particles: the position in snorm16 over the
+// [-1, 1] domain and the color in RGBA8, decoded by the vertex fetch
+struct PackedParticule {
+	std::int16_t position[3];
+	std::uint8_t color[4];
+};
+
+static_assert(sizeof(PackedParticule) == 10, "packed particles are 10 bytes");
+
+// Fixed size array aligned on a cache line.
+// The storage is rounded up to a whole number of cache lines and zeroed,
+// so SIMD loops may run over the padding past size() without a scalar tail.
+template<typename T>
+class AlignedArray
+{
+public:
+	static constexpr std::size_t Alignment = 64;
+
+	AlignedArray() = default;
+
+	explicit AlignedArray(std::size_t n)
+		: count(n)
+	{
+		if (n == 0)
+			return;
+
+		bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+		ptr = static_cast<T*>(::operator new(bytes, std::align_val_t(Alignment)));
+		for (std::size_t i = 0; i < bytes / sizeof(T); i++)
+			new (ptr + i) T();
+	}
+
+	~AlignedArray()
+	{
+		if (ptr)
+			::operator delete(ptr, std::align_val_t(Alignment));
+	}
+
+	AlignedArray(const AlignedArray&) = delete;
+	AlignedArray& operator=(const AlignedArray&) = delete;
+
+	AlignedArray(AlignedArray&& other) noexcept
+		: ptr(other.ptr), count(other.count), bytes(other.bytes)
+	{
+		other.ptr = nullptr;
+		other.count = other.bytes = 0;
+	}
+
+	AlignedArray& operator=(AlignedArray&& other) noexcept
+	{
+		std::swap(ptr, other.ptr);
+		std::swap(count, other.count);
+		std::swap(bytes, other.bytes);
+		return *this;
+	}
+
+	T* data() { return ptr; }
+	const T* data() const { return ptr; }
+	std::size_t size() const { return count; }
+	// Number of elements that can be safely touched, padding included
+	std::size_t padded_size() const { return bytes / sizeof(T); }
+
+	T& operator[](std::size_t i) { return ptr[i]; }
+	const T& operator[](std::size_t i) const { return ptr[i]; }
+
+private:
+	T* ptr = nullptr;
+	std::size_t count = 0;
+	std::size_t bytes = 0;
+};
+
+// Structure of arrays particle container.
+// Every field lives in its own contiguous array so the update loops only
+// stream the bytes they use. Capacity is fixed at construction: spawning
+// and killing never reallocate.
+class ParticleStore
+{
+public:
+	ParticleStore() = default;
+	explicit ParticleStore(std::size_t capacity);
+
+	std::size_t Size() const { return count; }
+	std::size_t Capacity() const { return capacity; }
+
+	// Appends up to n zeroed, immortal particles (less if the store is full).
+	// Returns the index of the first new particle, the new ones are [first, Size()).
+	std::size_t Spawn(std::size_t n);
+
+	// Removes particles by moving the last live ones into their slots.
+	void Kill(std::vector<std::size_t> indices);
+	// Same for every particle whose life is over; one pass, no allocation. Returns the count.
+	std::size_t KillExpired();
+	void Clear() { count = 0; }
+	// Exchanges two particles, every field included
+	void Swap(std::size_t a, std::size_t b);
+
+	// Copies the positions of particles [first, first + n) into the previous positions
+	void SavePositions(std::size_t first, std::size_t n);
+
+	// Writes particles [first, first + n) in the interleaved VBO layout.
+	// Positions are blended from the previous ones by alpha, except for
+	// particles that wrapped around the domain in between.
+	void Interleave(Particule* out, std::size_t first, std::size_t n, float alpha = 1.f) const;
+	// Inverse of Interleave, for particles stepped elsewhere (GPU backend)
+	void Deinterleave(const Particule* in, std::size_t first, std::size_t n);
+
+	AlignedArray<float> px, py, pz, mass;
+	AlignedArray<float> vx, vy, vz;
+	AlignedArray<glm::vec4> color;
+	AlignedArray<float> life; // remaining seconds, infinite for permanent particles
+	AlignedArray<float> rest; // seconds spent below the sleep speed, infinite while asleep (see SleepTracker)
+
+	// Positions before the last step, for render interpolation
+	AlignedArray<float> prevX, prevY, prevZ;
+
+	// Calls f on every per-particle array, for passes that move whole particles
+	template<typename F>
+	void ForEachField(F&& f)
+	{
+		f(px); f(py); f(pz); f(mass);
+		f(vx); f(vy); f(vz);
+		f(color);
+		f(life);
+		f(rest);
+		f(prevX); f(prevY); f(prevZ);
+	}
+
+private:
+	void Move(std::size_t from, std::size_t to);
+
+	std::size_t count = 0;
+	std::size_t capacity = 0;
+};
+
+// The fields of the particles that drawing reads (positions, previous
+// positions, mass and color), copied out of a store for the render thread.
+class DrawableParticles
+{
+public:
+	DrawableParticles() = default;
+	explicit DrawableParticles(std::size_t capacity);
+
+	std::size_t Size() const { return count; }
+	std::size_t Capacity() const { return capacity; }
+
+	// Sets the size without touching the particles, before Copy. n must not exceed the capacity.
+	void Resize(std::size_t n) { count = n; }
+	// Copies the drawn fields of particles [first, first + n) of from
+	void Copy(const ParticleStore& from, std::size_t first, std::size_t n);
+
+	// ParticleStore::Interleave of the particles listed in indices, written
+	// contiguously; the velocities are not drawn and stay zero
+	void InterleaveIndexed(Particule* out, const std::uint32_t* indices, std::size_t n, float alpha = 1.f) const;
+	// Interleave in the packed layout
+	void Pack(PackedParticule* out, std::size_t first, std::size_t n, float alpha = 1.f) const;
+	void PackIndexed(PackedParticule* out, const std::uint32_t* indices, std::size_t n, float alpha = 1.f) const;
+
+	AlignedArray<float> px, py, pz, mass;
+	AlignedArray<glm::vec4> color;
+	AlignedArray<float> prevX, prevY, prevZ;
+
+private:
+	std::size_t count = 0;
+	std::size_t capacity = 0;
+};
+
+class JobSystem;
+
+constexpr std::uint64_t DefaultParticuleSeed = 0x5EED;
+
+// Draws the initial state of particles [first, first + n) from the counter-based
+// generator: particle i only depends on seed and i, so any range can be filled
+// or regenerated independently
+void RandomizeParticules(ParticleStore& p, std::size_t first, std::size_t n, std::uint64_t seed = DefaultParticuleSeed);
+
+// capacity 0 makes a full store of n particles. With jobs, the particles are
+// drawn in parallel; the result is the same for any worker count.
+ParticleStore MakeParticules(const int n, std::size_t capacity = 0, JobSystem* jobs = nullptr, std::uint64_t seed = DefaultParticuleSeed);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). The output is a pure function of a 128-bit
+// counter and a 64-bit key, so particle i can draw its numbers from counter
+// {i, stream, block} without any shared state: ranges can be filled by any
+// number of threads, in any order, and any particle regenerated on its own.
+
+struct Philox4x32
+{
+	std::uint32_t v[4];
+};
+
+// Streams of the counter's third word, one per use, so they never overlap
+enum class RandomStream : std::uint32_t
+{
+	Init = 0,
+	Emitter = 1,
+};
+
+inline Philox4x32 Philox(Philox4x32 counter, std::uint64_t key)
+{
+	std::uint32_t k0 = std::uint32_t(key), k1 = std::uint32_t(key >> 32);
+	std::uint32_t* c = counter.v;
+
+	for (int round = 0; round < 10; round++)
+	{
+		const std::uint64_t p0 = std::uint64_t(0xD2511F53u) * c[0];
+		const std::uint64_t p1 = std::uint64_t(0xCD9E8D57u) * c[2];
+		const std::uint32_t h0 = std::uint32_t(p0 >> 32), l0 = std::uint32_t(p0);
+		const std::uint32_t h1 = std::uint32_t(p1 >> 32), l1 = std::uint32_t(p1);
+
+		c[0] = h1 ^ c[1] ^ k0;
+		c[1] = l1;
+		c[2] = h0 ^ c[3] ^ k1;
+		c[3] = l0;
+
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	return counter;
+}
+
+// Four numbers of block `block` of element `index` in `stream`
+inline Philox4x32 RandomBlock(std::uint64_t seed, RandomStream stream, std::uint64_t index, std::uint32_t block = 0)
+{
+	return Philox({ { std::uint32_t(index), std::uint32_t(index >> 32), std::uint32_t(stream), block } }, seed);
+}
+
+// [0, 1) from the top 24 bits, exact in a float
+inline float RandomUnit(std::uint32_t bits)
+{
+	return float(bits >> 8) * (1.f / 16777216.f);
+}
+
+// [a, b)
+inline float RandomRange(std::uint32_t bits, float a, float b)
+{
+	return a + (b - a) * RandomUnit(bits);
+}
@@ -0,0 +1,117 @@
+#include "reorder.h"
+
+#include "morton.h"
+#include "sort.h"
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+static unsigned bitLength(std::uint32_t v)
+{
+	unsigned n = 0;
+	while (v)
+	{
+		v >>= 1;
+		n++;
+	}
+	return n;
+}
+
+bool MortonReorder::Update(ParticleStore& p, JobSystem& jobs)
+{
+	if (++steps < checkInterval)
+		return false;
+	steps = 0;
+
+	// A sort would not bring the disorder much below its last result
+	const float disorder = Disorder(p, jobs);
+	if (disorder < threshold || (reorders > 0 && disorder < lastAfter + minGain))
+		return false;
+
+	Reorder(p, jobs);
+	return true;
+}
+
+void MortonReorder::computeCodes(const ParticleStore& p, JobSystem& jobs)
+{
+	const std::size_t n = p.Size();
+	codes.resize(n);
+	order.resize(n);
+
+	jobs.ParallelFor(0, n, 0, [&](std::size_t b, std::size_t e) {
+		for (std::size_t i = b; i < e; i++)
+		{
+			codes[i] = MortonCode(p.px[i], p.py[i], p.pz[i]);
+			order[i] = std::uint32_t(i);
+		}
+	});
+}
+
+float MortonReorder::disorderOfCodes(JobSystem& jobs)
+{
+	const std::size_t n = codes.size();
+	if (n < 2)
+		return 0.f;
+
+	// One partial sum per chunk, added up in order
+	const std::size_t chunk = 65536;
+	std::vector<unsigned long long> sums((n - 1 + chunk - 1) / chunk);
+	jobs.ParallelFor(0, n - 1, chunk, [&](std::size_t b, std::size_t e) {
+		unsigned long long sum = 0;
+		for (std::size_t i = b; i < e; i++)
+			sum += bitLength(codes[i] ^ codes[i + 1]);
+		sums[b / chunk] = sum;
+	});
+
+	unsigned long long total = 0;
+	for (const auto s : sums)
+		total += s;
+	return float(double(total) / double(n - 1) / MortonBits);
+}
+
+float MortonReorder::Disorder(const ParticleStore& p, JobSystem& jobs)
+{
+	computeCodes(p, jobs);
+	return disorderOfCodes(jobs);
+}
+
+void MortonReorder::Reorder(ParticleStore& p, JobSystem& jobs)
+{
+	const std::size_t n = p.Size();
+
+	computeCodes(p, jobs);
+	lastBefore = disorderOfCodes(jobs);
+
+	tmpCodes.resize(n);
+	tmpOrder.resize(n);
+	RadixSortPairs(codes.data(), order.data(), tmpCodes.data(), tmpOrder.data(), n, MortonBits, jobs);
+	lastAfter = disorderOfCodes(jobs);
+
+	if (scratch.size() != p.Capacity())
+	{
+		scratch = AlignedArray<float>(p.Capacity());
+		scratchColor = AlignedArray<glm::vec4>(p.Capacity());
+	}
+
+	// Gather every field into the scratch array, which then takes its place
+	p.ForEachField([&](auto& field) {
+		using T = typename std::remove_reference<decltype(field[0])>::type;
+		AlignedArray<T>* out = nullptr;
+		if constexpr (std::is_same<T, float>::value)
+			out = &scratch;
+		else
+			out = &scratchColor;
+
+		jobs.ParallelFor(0, n, 0, [&](std::size_t b, std::size_t e) {
+			for (std::size_t i = b; i < e; i++)
+				(*out)[i] = field[order[i]];
+		});
+		// The scratch tail holds values of an older order: keep the field's
+		// one, so the padding stays zeroed
+		std::copy(field.data() + n, field.data() + field.padded_size(), out->data() + n);
+		std::swap(field, *out);
+	});
+
+	reorders++;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "jobs.h"
+#include "particles.h"
+
+#include <cstdint>
+#include <vector>
+
+// Keeps particles that are close in space close in memory.
+// The disorder of an order is the mean bit length of the xor of the Morton
+// codes of consecutive particles, over 30: about 1 for a random order, near 0
+// once sorted, but it stays high for a small or sparse store whatever its
+// order. When it crosses the threshold and has grown by minGain since the
+// last sort, the particles are sorted by Morton code (parallel LSD radix
+// sort) and every field is gathered anew. The sort is a whole one rather
+// than incremental: four linear passes over the codes cost about as much as
+// locating the particles that moved.
+class MortonReorder
+{
+public:
+	float threshold = 0.6f;
+	float minGain = 0.1f; // disorder above the one left by the last sort
+	int checkInterval = 120; // steps between two disorder checks
+
+	// Counts a step; every checkInterval steps measures the disorder and
+	// reorders if needed. Returns true when the particles were reordered.
+	bool Update(ParticleStore& p, JobSystem& jobs);
+
+	float Disorder(const ParticleStore& p, JobSystem& jobs);
+	void Reorder(ParticleStore& p, JobSystem& jobs);
+
+	// Disorder before and after the last reorder; their ratio is the locality gain
+	float LastBefore() const { return lastBefore; }
+	float LastAfter() const { return lastAfter; }
+	int Reorders() const { return reorders; }
+
+private:
+	void computeCodes(const ParticleStore& p, JobSystem& jobs);
+	float disorderOfCodes(JobSystem& jobs);
+
+	int steps = 0;
+	int reorders = 0;
+	float lastBefore = 0.f, lastAfter = 0.f;
+
+	std::vector<std::uint32_t> codes, order, tmpCodes, tmpOrder;
+	AlignedArray<float> scratch;
+	AlignedArray<glm::vec4> scratchColor;
+};
@@ -1,5 +1,7 @@
 #version 450
 
+// From the ring: snorm16 position and RGBA8 color, normalized by the vertex
+// fetch. From the compute SSBO: floats. Both arrive in the same ranges.
 in vec3 position;
 in vec4 color;
 
@@ -0,0 +1,181 @@
+#include "simthread.h"
+
+#include <algorithm>
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::duration d)
+{
+	return std::chrono::duration<double>(d).count();
+}
+
+float ParticleSnapshot::Alpha(Clock::time_point now) const
+{
+	if (step <= 0.0)
+		return 1.f;
+	return float(std::min(1.0, alpha + seconds(now - time) / step));
+}
+
+SimulationThread::SimulationThread(Simulation& simulation, ParticleStore& particules, JobSystem& jobs)
+	: simulation(simulation), particules(particules), jobs(jobs)
+{
+	for (int i = 0; i < 3; i++)
+		snapshots.Slot(i).particles = DrawableParticles(particules.Capacity());
+}
+
+void SimulationThread::Start()
+{
+	if (thread.joinable())
+		return;
+
+	// The reader has a state from the first frame on
+	stopping = idle = false;
+	windowStart = Clock::now();
+	publish();
+	thread = std::thread(&SimulationThread::loop, this);
+}
+
+void SimulationThread::Stop()
+{
+	if (!thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	thread.join();
+}
+
+void SimulationThread::Post(std::function<void(Simulation&)> f)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		commands.push_back(std::move(f));
+	}
+	changed.notify_all();
+}
+
+void SimulationThread::Pause()
+{
+	if (!thread.joinable())
+		return;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	pauses++;
+	changed.notify_all();
+	changed.wait(lock, [this] { return idle; });
+}
+
+void SimulationThread::Resume()
+{
+	if (!thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pauses--;
+	}
+	changed.notify_all();
+}
+
+bool SimulationThread::Update()
+{
+	return snapshots.Update();
+}
+
+void SimulationThread::loop()
+{
+	Clock::time_point last = Clock::now();
+	std::vector<std::function<void(Simulation&)>> pending;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (pauses > 0 && !stopping)
+			{
+				idle = true;
+				changed.notify_all();
+				changed.wait(lock, [this] { return pauses == 0 || stopping; });
+				idle = false;
+				// The paused time is not simulated
+				last = Clock::now();
+			}
+			if (stopping)
+				return;
+			pending.swap(commands);
+		}
+		for (auto& f : pending)
+			f(simulation);
+		pending.clear();
+
+		const Clock::time_point start = Clock::now();
+		const double step = simulation.timestep.step;
+		const int steps = simulation.Advance(realTime ? seconds(start - last) : step);
+		last = start;
+
+		const Clock::time_point end = Clock::now();
+		if (steps > 0)
+		{
+			windowSteps += steps;
+			windowStepSeconds += seconds(end - start);
+			if (seconds(end - lastPublish) >= publishInterval)
+				publish();
+		}
+
+		const double window = seconds(Clock::now() - windowStart);
+		if (window >= 1.0)
+		{
+			stats.stepsPerSecond = windowSteps / window;
+			stats.stepMs = windowSteps ? 1e3 * windowStepSeconds / windowSteps : 0.0;
+			stats.publishMs = windowPublishes ? 1e3 * windowPublishSeconds / windowPublishes : 0.0;
+			windowStart = Clock::now();
+			windowSteps = 0;
+			windowStepSeconds = windowPublishSeconds = 0.0;
+			windowPublishes = 0;
+		}
+
+		// Nothing due: sleep until the next step, unless something is posted
+		if (realTime && steps == 0)
+		{
+			const auto wait = std::chrono::duration<double>((1.0 - simulation.Alpha()) * step);
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait_for(lock, wait, [this] { return pauses > 0 || stopping || !commands.empty(); });
+		}
+	}
+}
+
+void SimulationThread::publish()
+{
+	const Clock::time_point start = Clock::now();
+	ParticleSnapshot& s = snapshots.Back();
+
+	const std::size_t n = particules.Size();
+	s.particles.Resize(n);
+	jobs.ParallelFor(0, n, JobSystem::SimdChunk(simulation.settings.chunk),
+		[&](std::size_t b, std::size_t e) { s.particles.Copy(particules, b, e - b); });
+
+	stats.steps = simulation.timestep.TotalSteps();
+	stats.droppedTime = simulation.timestep.DroppedTime();
+	stats.published++;
+	stats.contacts = simulation.Contacts();
+	stats.sleeping = simulation.sleep.Sleeping();
+	stats.reorders = simulation.reorder.Reorders();
+	stats.disorderBefore = simulation.reorder.LastBefore();
+	stats.disorderAfter = simulation.reorder.LastAfter();
+	stats.energyDrift = simulation.energy.Drift();
+
+	s.alpha = realTime ? simulation.Alpha() : 1.f;
+	s.step = realTime ? simulation.timestep.step : 0.0;
+	s.stats = stats;
+	s.time = lastPublish = Clock::now();
+	snapshots.Publish();
+
+	windowPublishSeconds += seconds(lastPublish - start);
+	windowPublishes++;
+
+	if (recorder)
+		recorder->Record(particules, std::uint64_t(stats.steps), stats.steps * simulation.timestep.step, jobs);
+}
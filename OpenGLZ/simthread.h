@@ -0,0 +1,113 @@
+#pragma once
+
+#include "checkpoint.h"
+#include "jobs.h"
+#include "particles.h"
+#include "simulation.h"
+#include "triplebuffer.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SimulationStats
+{
+	long long steps = 0;
+	double droppedTime = 0.0; // seconds of wall clock the fixed step could not keep up with
+	double stepsPerSecond = 0.0; // over the last second
+	double stepMs = 0.0; // mean wall time of a step over the last second
+	double publishMs = 0.0; // mean time of a snapshot copy over the last second
+	std::size_t published = 0;
+	std::size_t contacts = 0, sleeping = 0;
+	int reorders = 0;
+	float disorderBefore = 0.f, disorderAfter = 0.f;
+	double energyDrift = 0.0;
+};
+
+// A state of the particles published by the simulation thread
+struct ParticleSnapshot
+{
+	DrawableParticles particles;
+	float alpha = 1.f; // blend factor when published
+	double step = 0.0; // seconds per step
+	std::chrono::steady_clock::time_point time; // when published
+	SimulationStats stats;
+
+	// Blend factor for drawing at now: the blend of publication moving on at the
+	// wall clock rate, so the drawing stays one step behind the simulation
+	float Alpha(std::chrono::steady_clock::time_point now) const;
+};
+
+// Runs a Simulation on its own thread. Every batch of fixed steps (see
+// Simulation::Advance) ends with a copy of the drawn fields into the back slot
+// of a triple buffer, so the render thread always finds the latest complete
+// state without waiting, and a slow step never holds a frame back.
+//
+// The thread runs its jobs on the simulation's job system; the render thread
+// should use a pool of its own, or its waits would run simulation jobs.
+//
+// Everything else goes through Post, run by the simulation thread between two
+// batches, or happens between Pause and Resume, when the thread is idle.
+class SimulationThread
+{
+public:
+	// Steps follow the wall clock; otherwise they run back to back as fast as they can
+	bool realTime = true;
+	// Least time between two snapshots, the copies are not free
+	double publishInterval = 1.0 / 240.0;
+
+	SimulationThread(Simulation& simulation, ParticleStore& particules, JobSystem& jobs);
+	~SimulationThread() { Stop(); }
+
+	SimulationThread(const SimulationThread&) = delete;
+	SimulationThread& operator=(const SimulationThread&) = delete;
+
+	void Start();
+	void Stop();
+
+	// Queues f, run on the simulation thread before its next batch
+	void Post(std::function<void(Simulation&)> f);
+
+	// Returns once the thread is idle. Until the matching Resume, the caller
+	// owns the simulation and its particles (the snapshots stay readable).
+	// Pauses nest.
+	void Pause();
+	void Resume();
+
+	// Checkpoint recorder fed with every published state, nullptr for none. Call while paused.
+	void SetRecorder(CheckpointRecorder* r) { recorder = r; }
+
+	// Render thread: takes the latest published state, if any. Returns whether it is new.
+	bool Update();
+	const ParticleSnapshot& Latest() { return snapshots.Front(); }
+
+private:
+	void loop();
+	void publish();
+
+	Simulation& simulation;
+	ParticleStore& particules;
+	JobSystem& jobs;
+	CheckpointRecorder* recorder = nullptr;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::vector<std::function<void(Simulation&)>> commands;
+	int pauses = 0; // Pause calls not resumed yet
+	bool stopping = false, idle = false;
+
+	TripleBuffer<ParticleSnapshot> snapshots;
+	std::chrono::steady_clock::time_point lastPublish;
+
+	// Rolling second of the stats
+	SimulationStats stats;
+	std::chrono::steady_clock::time_point windowStart;
+	long long windowSteps = 0;
+	double windowStepSeconds = 0.0, windowPublishSeconds = 0.0;
+	std::size_t windowPublishes = 0;
+};
@@ -0,0 +1,180 @@
+#include "simulation.h"
+
+Simulation::Simulation(ParticleStore& particules, JobSystem& jobs)
+	: particules(particules), jobs(jobs)
+{
+}
+
+void Simulation::Step(float dt)
+{
+	const auto integrate = UniformKernel(settings.scheme, settings.integrate);
+	ParticleStore& p = particules;
+
+	// The carried accelerations follow the particles by index, and the energy
+	// reference holds for a fixed set of particles
+	const std::size_t changes = emitter.Spawned() + emitter.Killed();
+	if (settings.emit)
+		emitter.Update(p, dt, jobs);
+	bool moved = emitter.Spawned() + emitter.Killed() != changes;
+	if (moved)
+		InvalidateForces();
+
+	if (settings.reorder && reorder.Update(p, jobs))
+	{
+		forcesValid = false;
+		moved = true;
+	}
+
+	if (settings.mode != forcesMode || settings.scheme != forcesScheme)
+	{
+		InvalidateForces();
+		forcesMode = settings.mode;
+		forcesScheme = settings.scheme;
+	}
+
+	// The collider tests the move of this step, from the saved positions
+	const bool collide = settings.collide && !collider.Empty();
+
+	// Only particles resting on the mesh under the uniform field can sleep;
+	// anything else changes their forces
+	const bool sleeping = settings.sleep && collide && settings.mode == SimulationMode::Uniform;
+	if (!sleeping)
+		sleep.WakeAll(p, jobs);
+	else if (moved && sleep.Sleeping() > 0)
+		sleep.Rebuild(p, jobs);
+	const std::size_t active = sleep.Awake(p);
+
+	if (collide)
+		jobs.ParallelFor(0, active, chunk(),
+			[&p](std::size_t b, std::size_t e) { p.SavePositions(b, e - b); });
+
+	if (settings.mode == SimulationMode::Uniform)
+		jobs.ParallelFor(0, active, chunk(),
+			[&p, integrate, dt](std::size_t b, std::size_t e) { integrate(p, b, e, dt, Gravity); });
+	else if (settings.mode == SimulationMode::Fluid)
+		sph.Step(p, dt, jobs);
+	else
+		stepBarnesHut(dt);
+
+	if (sleeping && hits.size() < p.Capacity())
+		hits.resize(p.Capacity());
+	contacts = collide ? collider.Collide(p, active, chunk(), jobs, sleeping ? hits.data() : nullptr) : 0;
+	if (contacts > 0)
+		forcesValid = false;
+
+	if (sleeping)
+		sleep.Update(p, hits.data(), dt, jobs);
+}
+
+void Simulation::InvalidateForces()
+{
+	forcesValid = false;
+	energy.Reset();
+}
+
+void Simulation::computeForces(float* potential)
+{
+	ParticleStore& p = particules;
+	octree.theta = settings.theta;
+	octree.softening = settings.softening;
+	octree.Build(p, jobs);
+	if (potential)
+		octree.Accelerations(settings.G, ax.data(), ay.data(), az.data(), potential, jobs);
+	else
+		octree.Accelerations(settings.G, ax.data(), ay.data(), az.data(), jobs);
+}
+
+Energy Simulation::MeasureEnergy()
+{
+	ParticleStore& p = particules;
+	Energy e;
+	e.kinetic = KineticEnergy(p, jobs);
+
+	if (settings.mode == SimulationMode::Uniform)
+		e.potential = UniformPotentialEnergy(p, Gravity, jobs);
+	else if (settings.mode == SimulationMode::BarnesHut)
+	{
+		// The walk gives the accelerations of the current positions too
+		if (phi.size() != p.Capacity())
+			phi = AlignedArray<float>(p.Capacity());
+		if (ax.size() != p.Capacity())
+		{
+			ax = AlignedArray<float>(p.Capacity());
+			ay = AlignedArray<float>(p.Capacity());
+			az = AlignedArray<float>(p.Capacity());
+		}
+		computeForces(phi.data());
+		forcesValid = true;
+		e.potential = PairPotentialEnergy(p, phi.data(), jobs);
+	}
+	return e;
+}
+
+void Simulation::stepBarnesHut(float dt)
+{
+	const auto integrate = settings.integrate;
+	const auto scheme = settings.scheme;
+	ParticleStore& p = particules;
+
+	if (ax.size() != p.Capacity())
+	{
+		ax = AlignedArray<float>(p.Capacity());
+		ay = AlignedArray<float>(p.Capacity());
+		az = AlignedArray<float>(p.Capacity());
+		forcesValid = false;
+	}
+
+	// Euler needs the accelerations of the start of the step. The second-order
+	// schemes end each step with those of its end, so they take one walk per
+	// step like Euler once started.
+	if (scheme == IntegrationScheme::SemiImplicitEuler || !forcesValid)
+		computeForces(nullptr);
+
+	const float* x = ax.data();
+	const float* y = ay.data();
+	const float* z = az.data();
+	const float half = 0.5f * dt;
+
+	// Drifting with g = 0 is the position update of semi-implicit Euler
+	jobs.ParallelFor(0, p.Size(), chunk(), [&](std::size_t b, std::size_t e) {
+		if (scheme == IntegrationScheme::VelocityVerlet)
+		{
+			DriftVerlet(p, b, e, x, y, z, dt);
+			Kick(p, b, e, x, y, z, half);
+		}
+		else
+		{
+			Kick(p, b, e, x, y, z, scheme == IntegrationScheme::LeapfrogKDK ? half : dt);
+			integrate(p, b, e, dt, 0.f);
+		}
+	});
+
+	if (scheme == IntegrationScheme::SemiImplicitEuler)
+	{
+		forcesValid = false;
+		return;
+	}
+
+	computeForces(nullptr);
+	jobs.ParallelFor(0, p.Size(), chunk(),
+		[&](std::size_t b, std::size_t e) { Kick(p, b, e, x, y, z, half); });
+	forcesValid = true;
+}
+
+int Simulation::Advance(double frameDt)
+{
+	const int steps = timestep.Advance(frameDt);
+	ParticleStore& p = particules;
+
+	for (int s = 0; s < steps; s++)
+	{
+		// Step saves them itself when colliding; sleepers keep theirs
+		if (s == steps - 1 && !(settings.collide && !collider.Empty()))
+			jobs.ParallelFor(0, Active(), chunk(),
+				[&p](std::size_t b, std::size_t e) { p.SavePositions(b, e - b); });
+
+		Step(float(timestep.step));
+	}
+
+	return steps;
+}
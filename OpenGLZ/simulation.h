@@ -0,0 +1,102 @@
+#pragma once
+
+#include "collider.h"
+#include "emitter.h"
+#include "energy.h"
+#include "integrator.h"
+#include "jobs.h"
+#include "octree.h"
+#include "particles.h"
+#include "reorder.h"
+#include "sleep.h"
+#include "sph.h"
+#include "timestep.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class SimulationMode
+{
+	Uniform, // constant downward field
+	BarnesHut, // mutual gravitation through the octree
+	Fluid // SPH in a closed box
+};
+
+struct SimulationSettings
+{
+	IntegrateKernel integrate = IntegrateScalar; // semi-implicit Euler kernel of the uniform mode
+	IntegrationScheme scheme = IntegrationScheme::SemiImplicitEuler; // uniform and Barnes-Hut modes, SPH has its own
+	std::size_t chunk = 0; // particles per job, rounded up to a multiple of 8, 0: automatic
+
+	SimulationMode mode = SimulationMode::Uniform;
+	bool emit = false; // run the emitter (ageing, retiring and spawning) every step
+	bool reorder = true; // sort the particles by Morton code when they get scattered
+	bool collide = false; // bounce the particles off the collider mesh
+	bool sleep = false; // let the particles settled on the mesh sleep (uniform mode with collisions only)
+
+	// Barnes-Hut
+	float G = 1e-4f;
+	float theta = 0.5f;
+	float softening = 0.01f;
+};
+
+// Advances a particle store by one step, on the job system
+class Simulation
+{
+public:
+	Simulation(ParticleStore& particules, JobSystem& jobs);
+
+	SimulationSettings settings;
+	FixedTimestep timestep;
+	Emitter emitter;
+	MortonReorder reorder;
+	MeshCollider collider;
+	SleepTracker sleep;
+
+	void Step(float dt);
+
+	// Runs the fixed steps due after a frame of frameDt seconds, saving the
+	// positions before the last one for Interleave. Returns the step count.
+	int Advance(double frameDt);
+
+	// Blend factor between the previous and current positions for drawing
+	float Alpha() const { return timestep.Alpha(); }
+
+	// Particles stopped by the collider mesh during the last step
+	std::size_t Contacts() const { return contacts; }
+
+	// Particles a step runs on, the awake ones [0, Active())
+	std::size_t Active() const { return sleep.Awake(particules); }
+
+	// Energy of the particles in the current mode (kinetic only for SPH).
+	// In Barnes-Hut mode this walks the tree, at the cost of a step.
+	Energy MeasureEnergy();
+
+	// Samples MeasureEnergy; reset when the forces are invalidated
+	EnergyMonitor energy;
+
+	// Forgets the accelerations the second-order schemes carry from a step to
+	// the next. Needed after the particles are changed outside of Step.
+	void InvalidateForces();
+
+	const Octree& Tree() const { return octree; }
+	SphSolver& Fluid() { return sph; }
+
+private:
+	void stepBarnesHut(float dt);
+	void computeForces(float* phi);
+	std::size_t chunk() const { return JobSystem::SimdChunk(settings.chunk); }
+
+	ParticleStore& particules;
+	JobSystem& jobs;
+
+	Octree octree;
+	SphSolver sph;
+	AlignedArray<float> ax, ay, az, phi;
+	bool forcesValid = false; // ax, ay, az hold the accelerations of the current positions
+	SimulationMode forcesMode = SimulationMode::Uniform;
+	IntegrationScheme forcesScheme = IntegrationScheme::SemiImplicitEuler;
+	std::size_t contacts = 0;
+	std::vector<std::uint8_t> hits;
+};
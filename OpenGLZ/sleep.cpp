@@ -0,0 +1,235 @@
+#include "sleep.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static constexpr std::size_t Chunk = 16384;
+
+// Grid coordinates of the particle's cell
+void SleepTracker::cellOf(const ParticleStore& p, std::size_t i, std::int64_t cell[3]) const
+{
+	const float scale = 1.f / wakeRadius;
+	cell[0] = std::int64_t(std::floor((p.px[i] + 1.f) * scale));
+	cell[1] = std::int64_t(std::floor((p.py[i] + 1.f) * scale));
+	cell[2] = std::int64_t(std::floor((p.pz[i] + 1.f) * scale));
+}
+
+// Set key of a cell, 21 bits per coordinate
+static inline std::uint64_t keyOf(std::int64_t x, std::int64_t y, std::int64_t z)
+{
+	return (std::uint64_t(z & 0x1fffff) << 42) | (std::uint64_t(y & 0x1fffff) << 21) | std::uint64_t(x & 0x1fffff);
+}
+
+static inline std::uint64_t keyOf(const std::int64_t cell[3])
+{
+	return keyOf(cell[0], cell[1], cell[2]);
+}
+
+static inline std::size_t slotOf(std::uint64_t cell, std::size_t mask)
+{
+	return std::size_t((cell * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+void SleepTracker::disturb(std::uint64_t cell)
+{
+	const std::size_t mask = disturbed.size() - 1;
+	std::size_t s = slotOf(cell, mask);
+	while (disturbed[s] != 0 && disturbed[s] != cell + 1)
+		s = (s + 1) & mask;
+	disturbed[s] = cell + 1;
+}
+
+bool SleepTracker::isDisturbed(std::uint64_t cell) const
+{
+	const std::size_t mask = disturbed.size() - 1;
+	for (std::size_t s = slotOf(cell, mask);; s = (s + 1) & mask)
+	{
+		if (disturbed[s] == cell + 1)
+			return true;
+		if (disturbed[s] == 0)
+			return false;
+	}
+}
+
+void SleepTracker::Update(ParticleStore& p, const std::uint8_t* hits, float dt, JobSystem& jobs)
+{
+	const std::size_t n = p.Size();
+	const std::size_t awake = n - sleeping;
+	const std::size_t chunks = (n + Chunk - 1) / Chunk;
+	const float rest2 = speed * speed * dt * dt;
+	const float wake2 = wakeSpeed * wakeSpeed * dt * dt;
+
+	falling.resize(n);
+	waking.resize(n);
+	disturbing.resize(n);
+	fallingCounts.assign(chunks, 0);
+	wakingCounts.assign(chunks, 0);
+	disturbingCounts.assign(chunks, 0);
+
+	// Rest times of the awake particles; the rested ones touching the mesh are
+	// listed to fall asleep, the fast ones touching it as disturbances
+	jobs.ParallelFor(0, awake, Chunk, [&](std::size_t b, std::size_t e) {
+		std::size_t asleep = 0, fast = 0;
+		for (std::size_t i = b; i < e; i++)
+		{
+			const float dx = p.px[i] - p.prevX[i];
+			const float dy = p.py[i] - p.prevY[i];
+			const float dz = p.pz[i] - p.prevZ[i];
+			const float d2 = dx * dx + dy * dy + dz * dz;
+			p.rest[i] = d2 < rest2 ? p.rest[i] + dt : 0.f;
+			if (!hits[i])
+				continue;
+
+			if (d2 > wake2)
+				disturbing[b + fast++] = std::uint32_t(i);
+			else if (p.rest[i] >= delay)
+				falling[b + asleep++] = std::uint32_t(i);
+		}
+		fallingCounts[b / Chunk] = asleep;
+		disturbingCounts[b / Chunk] = fast;
+	});
+
+	std::size_t disturbances = 0;
+	for (const std::size_t c : disturbingCounts)
+		disturbances += c;
+
+	if (disturbances > 0 && sleeping > 0)
+	{
+		// Set of the disturbed cells, at most half full
+		std::size_t size = 16;
+		while (size < 2 * 27 * disturbances)
+			size *= 2;
+		disturbed.assign(size, 0);
+		for (std::size_t c = 0; c < chunks; c++)
+		{
+			for (std::size_t k = 0; k < disturbingCounts[c]; k++)
+			{
+				std::int64_t cell[3];
+				cellOf(p, disturbing[c * Chunk + k], cell);
+				for (std::int64_t z = cell[2] - 1; z <= cell[2] + 1; z++)
+					for (std::int64_t y = cell[1] - 1; y <= cell[1] + 1; y++)
+						for (std::int64_t x = cell[0] - 1; x <= cell[0] + 1; x++)
+							disturb(keyOf(x, y, z));
+			}
+		}
+
+		jobs.ParallelFor(awake, n, Chunk, [&](std::size_t b, std::size_t e) {
+			// Chunks start at awake, Chunk apart: each one owns a distinct slice of the list
+			const std::size_t c = b / Chunk;
+			std::size_t count = 0;
+			for (std::size_t i = b; i < e; i++)
+			{
+				std::int64_t cell[3];
+				cellOf(p, i, cell);
+				if (isDisturbed(keyOf(cell)))
+					waking[c * Chunk + count++] = std::uint32_t(i);
+			}
+			wakingCounts[c] = count;
+		});
+	}
+
+	// Woken particles, in increasing order, swap with the first sleeper: every
+	// swap only touches slots at or before the particle, so the later entries
+	// of the list stay where they were
+	woken = 0;
+	for (std::size_t c = 0; c < chunks; c++)
+	{
+		for (std::size_t k = 0; k < wakingCounts[c]; k++)
+		{
+			const std::size_t i = waking[c * Chunk + k];
+			const std::size_t first = n - sleeping;
+			p.rest[i] = 0.f;
+			if (i != first)
+				p.Swap(i, first);
+			sleeping--;
+			woken++;
+		}
+	}
+
+	// Sleepers, in decreasing order, swap with the last awake particle
+	fellAsleep = 0;
+	for (std::size_t c = chunks; c-- > 0;)
+	{
+		for (std::size_t k = fallingCounts[c]; k-- > 0;)
+		{
+			const std::size_t i = falling[c * Chunk + k];
+			p.vx[i] = p.vy[i] = p.vz[i] = 0.f;
+			p.prevX[i] = p.px[i];
+			p.prevY[i] = p.py[i];
+			p.prevZ[i] = p.pz[i];
+			p.rest[i] = std::numeric_limits<float>::infinity();
+
+			const std::size_t last = n - sleeping - 1;
+			if (i != last)
+				p.Swap(i, last);
+			sleeping++;
+			fellAsleep++;
+		}
+	}
+}
+
+void SleepTracker::WakeAll(ParticleStore& p, JobSystem& jobs)
+{
+	if (sleeping == 0)
+		return;
+
+	// The whole store: the sleepers may have been moved since the last partition
+	jobs.ParallelFor(0, p.Size(), Chunk, [&p](std::size_t b, std::size_t e) {
+		std::fill(p.rest.data() + b, p.rest.data() + e, 0.f);
+	});
+	woken = sleeping;
+	sleeping = 0;
+}
+
+void SleepTracker::Rebuild(ParticleStore& p, JobSystem& jobs)
+{
+	const std::size_t n = p.Size();
+	const std::size_t chunks = (n + Chunk - 1) / Chunk;
+	sleepingCounts.assign(chunks, 0);
+	misplacedCounts.assign(chunks, 0);
+	misplaced.resize(n);
+
+	jobs.ParallelFor(0, n, Chunk, [&](std::size_t b, std::size_t e) {
+		std::size_t count = 0;
+		for (std::size_t i = b; i < e; i++)
+			count += std::isinf(p.rest[i]);
+		sleepingCounts[b / Chunk] = count;
+	});
+
+	sleeping = 0;
+	for (const std::size_t c : sleepingCounts)
+		sleeping += c;
+	const std::size_t boundary = n - sleeping;
+
+	// Misplaced: a sleeper before the boundary or an awake particle after it
+	jobs.ParallelFor(0, n, Chunk, [&](std::size_t b, std::size_t e) {
+		std::size_t count = 0;
+		for (std::size_t i = b; i < e; i++)
+		{
+			misplaced[b + count] = std::uint32_t(i);
+			count += std::isinf(p.rest[i]) == (i < boundary);
+		}
+		misplacedCounts[b / Chunk] = count;
+	});
+
+	// There are as many misplaced particles on both sides: the k-th of the
+	// front swaps with the k-th of the back, every pair touching its own slots
+	std::vector<std::uint32_t>& front = falling;
+	std::vector<std::uint32_t>& back = waking;
+	front.clear();
+	back.clear();
+	for (std::size_t c = 0; c < chunks; c++)
+	{
+		for (std::size_t k = 0; k < misplacedCounts[c]; k++)
+		{
+			const std::uint32_t i = misplaced[c * Chunk + k];
+			(i < boundary ? front : back).push_back(i);
+		}
+	}
+
+	jobs.ParallelFor(0, front.size(), Chunk, [&](std::size_t b, std::size_t e) {
+		for (std::size_t k = b; k < e; k++)
+			p.Swap(front[k], back[k]);
+	});
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "jobs.h"
+#include "particles.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Puts the particles settled on the collider mesh to sleep, so that a step only
+// costs the awake ones. The store is kept partitioned: particles [0, Awake())
+// are awake and stepped as before, the sleeping ones sit at the back untouched.
+//
+// Speeds are measured over the step, from the previous positions the collider
+// uses: a particle resting on the mesh keeps bouncing off it with a speed of
+// about restitution * g dt, but ends every step where it started.
+// A particle counts its rest time (ParticleStore::rest) while its speed stays
+// under speed, and falls asleep at a contact with the mesh once it has rested
+// for delay seconds: a slow particle in the air is at the top of its arc, not
+// at rest. A sleeping particle has no speed, its previous position is its
+// position and its rest time is infinite.
+//
+// An awake particle hitting the mesh faster than wakeSpeed disturbs its cell of
+// a grid of edge wakeRadius and the 26 cells around it, which wakes the
+// sleepers of those cells: every sleeper closer than wakeRadius on each axis
+// wakes, wherever the grid lines fall. The disturbed cells go to a small hash
+// set that the sleepers look up, so a step without disturbance does not read
+// them at all. Changes of the forces call WakeAll.
+class SleepTracker
+{
+public:
+	float speed = 0.05f;
+	float delay = 0.25f; // seconds
+	float wakeSpeed = 0.2f;
+	float wakeRadius = 0.005f;
+
+	std::size_t Awake(const ParticleStore& p) const { return p.Size() - sleeping; }
+	std::size_t Sleeping() const { return sleeping; }
+
+	// Particles put to sleep and woken by the last Update
+	std::size_t FellAsleep() const { return fellAsleep; }
+	std::size_t Woken() const { return woken; }
+
+	// After a step of the awake particles: updates their rest times from their
+	// move since the previous positions and their hits (one byte per awake particle, see MeshCollider::Collide),
+	// wakes the sleepers of the disturbed cells and moves the particles that
+	// fell asleep to the back
+	void Update(ParticleStore& p, const std::uint8_t* hits, float dt, JobSystem& jobs);
+
+	void WakeAll(ParticleStore& p, JobSystem& jobs);
+
+	// Partitions the store again after its particles were permuted, spawned or
+	// killed: chunks list their misplaced particles in parallel, and only
+	// those are swapped
+	void Rebuild(ParticleStore& p, JobSystem& jobs);
+
+private:
+	void cellOf(const ParticleStore& p, std::size_t i, std::int64_t cell[3]) const;
+	void disturb(std::uint64_t key);
+	bool isDisturbed(std::uint64_t cell) const;
+
+	std::size_t sleeping = 0;
+	std::size_t fellAsleep = 0, woken = 0;
+
+	// Open addressing, keys + 1 so that 0 marks a free slot
+	std::vector<std::uint64_t> disturbed;
+
+	// Per chunk lists, compacted in place like FrustumCuller
+	std::vector<std::uint32_t> falling, waking, disturbing;
+	std::vector<std::size_t> fallingCounts, wakingCounts, disturbingCounts;
+
+	// Rebuild: sleepers per chunk, then the sleepers before the boundary and
+	// the awake particles after it
+	std::vector<std::size_t> sleepingCounts, misplacedCounts;
+	std::vector<std::uint32_t> misplaced;
+};
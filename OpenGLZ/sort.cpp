@@ -0,0 +1,75 @@
+#include "sort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+void RadixSortPairs(
+	std::uint32_t* keys,
+	std::uint32_t* values,
+	std::uint32_t* tmpKeys,
+	std::uint32_t* tmpValues,
+	std::size_t n,
+	unsigned keyBits,
+	JobSystem& jobs)
+{
+	constexpr unsigned Radix = 256;
+
+	if (n == 0)
+		return;
+
+	// Small blocks are not worth a job each
+	const std::size_t blocks = std::max<std::size_t>(1, std::min<std::size_t>(n / 16384, (jobs.WorkerCount() + 1) * 4));
+	const std::size_t blockSize = (n + blocks - 1) / blocks;
+
+	std::vector<std::size_t> counts(blocks * Radix);
+
+	std::uint32_t* srcKeys = keys;
+	std::uint32_t* srcValues = values;
+	std::uint32_t* dstKeys = tmpKeys;
+	std::uint32_t* dstValues = tmpValues;
+
+	for (unsigned shift = 0; shift < keyBits; shift += 8)
+	{
+		std::fill(counts.begin(), counts.end(), 0);
+
+		jobs.ParallelFor(0, n, blockSize, [&](std::size_t b, std::size_t e) {
+			std::size_t* c = &counts[(b / blockSize) * Radix];
+			for (std::size_t i = b; i < e; i++)
+				c[(srcKeys[i] >> shift) & (Radix - 1)]++;
+		});
+
+		// Digit major, block minor: block k writes its digit d after every
+		// smaller digit and after the d's of the blocks before it
+		std::size_t offset = 0;
+		for (unsigned d = 0; d < Radix; d++)
+		{
+			for (std::size_t k = 0; k < blocks; k++)
+			{
+				const std::size_t c = counts[k * Radix + d];
+				counts[k * Radix + d] = offset;
+				offset += c;
+			}
+		}
+
+		jobs.ParallelFor(0, n, blockSize, [&](std::size_t b, std::size_t e) {
+			std::size_t* o = &counts[(b / blockSize) * Radix];
+			for (std::size_t i = b; i < e; i++)
+			{
+				const std::size_t dst = o[(srcKeys[i] >> shift) & (Radix - 1)]++;
+				dstKeys[dst] = srcKeys[i];
+				dstValues[dst] = srcValues[i];
+			}
+		});
+
+		std::swap(srcKeys, dstKeys);
+		std::swap(srcValues, dstValues);
+	}
+
+	if (srcKeys != keys)
+	{
+		std::memcpy(keys, srcKeys, n * sizeof(std::uint32_t));
+		std::memcpy(values, srcValues, n * sizeof(std::uint32_t));
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "jobs.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Stable LSD radix sort of (key, value) pairs on the low keyBits bits of the keys.
+// Each 8-bit pass histograms blocks of the input in parallel, prefix sums the
+// per-block counts and scatters every block in parallel to its own offsets.
+// tmpKeys and tmpValues must hold n elements; the result ends up in keys/values.
+void RadixSortPairs(
+	std::uint32_t* keys,
+	std::uint32_t* values,
+	std::uint32_t* tmpKeys,
+	std::uint32_t* tmpValues,
+	std::size_t n,
+	unsigned keyBits,
+	JobSystem& jobs);
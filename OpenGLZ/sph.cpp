@@ -0,0 +1,109 @@
+#include "sph.h"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr float Pi = 3.14159265358979f;
+
+void SphSolver::Reserve(std::size_t capacity)
+{
+	density = AlignedArray<float>(capacity);
+	pressure = AlignedArray<float>(capacity);
+	ax = AlignedArray<float>(capacity);
+	ay = AlignedArray<float>(capacity);
+	az = AlignedArray<float>(capacity);
+
+	// The reserved particles fill the box at rest density
+	const float n = float(std::max<std::size_t>(capacity, 1));
+	h = settings.smoothingLength > 0.f ? settings.smoothingLength : std::cbrt(40.f * 8.f * 3.f / (4.f * Pi * n));
+	particleMass = settings.restDensity * 8.f / n;
+	grid.Reserve(capacity, h);
+}
+
+void SphSolver::Step(ParticleStore& p, float dt, JobSystem& jobs)
+{
+	if (Capacity() < p.Capacity())
+		Reserve(p.Capacity());
+
+	const std::size_t n = p.Size();
+	const float h2 = h * h;
+	const float m = particleMass;
+	const float poly6 = 315.f / (64.f * Pi * std::pow(h, 9.f));
+	const float spikyGrad = -45.f / (Pi * std::pow(h, 6.f));
+	const float viscLaplacian = 45.f / (Pi * std::pow(h, 6.f));
+	const SphSettings s = settings;
+
+	grid.Build(p.px.data(), p.py.data(), p.pz.data(), n, h, jobs);
+	const auto& index = grid.Index();
+
+	// Particles are visited cell by cell, so neighbouring queries hit the same memory
+	jobs.ParallelFor(0, n, 0, [&](std::size_t b, std::size_t e) {
+		for (std::size_t k = b; k < e; k++)
+		{
+			const auto i = index[k];
+			float rho = 0.f;
+			grid.ForEachNeighbor(p.px[i], p.py[i], p.pz[i], h, [&](std::uint32_t, float, float, float, float d2) {
+				const float q = h2 - d2;
+				rho += q * q * q;
+			});
+
+			density[i] = m * poly6 * rho;
+			pressure[i] = std::max(0.f, s.stiffness * (density[i] - s.restDensity));
+		}
+	});
+
+	jobs.ParallelFor(0, n, 0, [&](std::size_t b, std::size_t e) {
+		for (std::size_t k = b; k < e; k++)
+		{
+			const auto i = index[k];
+			const float pi = pressure[i];
+			const float vxi = p.vx[i], vyi = p.vy[i], vzi = p.vz[i];
+			float fx = 0.f, fy = 0.f, fz = 0.f;
+
+			grid.ForEachNeighbor(p.px[i], p.py[i], p.pz[i], h, [&](std::uint32_t j, float dx, float dy, float dz, float d2) {
+				if (j == i || d2 == 0.f)
+					return;
+
+				const float r = std::sqrt(d2);
+				const float w = h - r;
+				const float invRhoJ = 1.f / density[j];
+
+				// Pressure pushes along -grad W, dx points from i to j
+				const float fp = -m * (pi + pressure[j]) * 0.5f * invRhoJ * spikyGrad * w * w / r;
+				fx -= fp * dx;
+				fy -= fp * dy;
+				fz -= fp * dz;
+
+				const float fv = s.viscosity * m * invRhoJ * viscLaplacian * w;
+				fx += fv * (p.vx[j] - vxi);
+				fy += fv * (p.vy[j] - vyi);
+				fz += fv * (p.vz[j] - vzi);
+			});
+
+			const float invRho = 1.f / density[i];
+			ax[i] = fx * invRho;
+			ay[i] = fy * invRho + s.gravity;
+			az[i] = fz * invRho;
+		}
+	});
+
+	jobs.ParallelFor(0, n, 0, [&](std::size_t b, std::size_t e) {
+		const auto bounce = [&s](float& x, float& v) {
+			if (x < -1.f) { x = -1.f; v = -v * s.wallDamping; }
+			if (x > 1.f) { x = 1.f; v = -v * s.wallDamping; }
+		};
+
+		for (std::size_t i = b; i < e; i++)
+		{
+			p.vx[i] += ax[i] * dt;
+			p.vy[i] += ay[i] * dt;
+			p.vz[i] += az[i] * dt;
+			p.px[i] += p.vx[i] * dt;
+			p.py[i] += p.vy[i] * dt;
+			p.pz[i] += p.vz[i] * dt;
+			bounce(p.px[i], p.vx[i]);
+			bounce(p.py[i], p.vy[i]);
+			bounce(p.pz[i], p.vz[i]);
+		}
+	});
+}
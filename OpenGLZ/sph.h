@@ -0,0 +1,42 @@
+#pragma once
+
+#include "grid.h"
+#include "jobs.h"
+#include "particles.h"
+
+#include <cstddef>
+
+struct SphSettings
+{
+	float smoothingLength = 0.f; // h, 0: about 40 neighbours at rest for the reserved capacity
+	float restDensity = 1000.f;
+	float stiffness = 10.f; // pressure = stiffness * (density - restDensity)
+	float viscosity = 0.02f;
+	float gravity = -0.981f;
+	float wallDamping = 0.5f; // fraction of the normal speed kept when bouncing on the box
+};
+
+// Smoothed-particle hydrodynamics in the [-1, 1] box (Muller et al. 2003 kernels).
+// Every array is sized by Reserve; a step runs a grid build, a density and
+// pressure pass, a force pass and an integration pass, each one data parallel.
+// The fluid bounces on the walls of the box instead of wrapping around.
+// The default stiffness needs steps of about 5 ms or less to stay stable.
+class SphSolver
+{
+public:
+	SphSettings settings;
+
+	// Sizes every buffer for up to capacity particles, Step does not allocate them again
+	void Reserve(std::size_t capacity);
+	std::size_t Capacity() const { return density.size(); }
+
+	void Step(ParticleStore& p, float dt, JobSystem& jobs);
+
+	const AlignedArray<float>& Density() const { return density; }
+
+private:
+	SpatialGrid grid;
+	float h = 0.f, particleMass = 0.f;
+	AlignedArray<float> density, pressure;
+	AlignedArray<float> ax, ay, az;
+};
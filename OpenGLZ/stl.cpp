@@ -1,42 +1,209 @@
 #include "stl.h"
 
-#include <fstream>
+#include "jobs.h"
+#include "meshparse.h"
 
-std::vector<Triangle> ReadStl(const char * filename)
+#include <algorithm>
+#include <cstring>
+
+static std::uint32_t announcedCount(const char* data)
+{
+	std::uint32_t count;
+	std::memcpy(&count, data + 80, 4);
+	return count;
+}
+
+StlFormat DetectStl(const char* data, std::size_t size)
+{
+	const bool binary = size >= StlHeaderSize && (size - StlHeaderSize) / StlRecordSize >= announcedCount(data);
+
+	std::size_t i = 0;
+	while (i < size && IsBlank(data[i]))
+		i++;
+	if (size - i < 5 || std::memcmp(data + i, "solid", 5) != 0)
+		return binary ? StlFormat::Binary : StlFormat::Invalid;
+
+	if (binary && size - StlHeaderSize == std::uint64_t(announcedCount(data)) * StlRecordSize)
+		return StlFormat::Binary;
+	if (binary && std::memchr(data, 0, std::min<std::size_t>(size, 512)))
+		return StlFormat::Binary;
+	return StlFormat::Ascii;
+}
+
+bool StlView::Open(const char* filename)
 {
-	std::ifstream file(filename, std::ios::in | std::ios::binary);
-	if (file.is_open())
+	count = 0;
+	if (!file.Open(filename) || DetectStl(file.Data(), file.Size()) != StlFormat::Binary)
 	{
-		// skip header
-		file.seekg(80);
+		file.Close();
+		return false;
+	}
 
-		unsigned triCount;
-		file.read((char*) &triCount, 4);
+	count = announcedCount(file.Data());
+	return true;
+}
 
-		std::vector<Triangle> tris;
-		tris.reserve(triCount);
+glm::vec3 StlView::Vertex(std::size_t i, int k) const
+{
+	glm::vec3 v;
+	std::memcpy(&v, Records() + i * StlRecordSize + offsetof(StlRecord, vertices) + k * sizeof(glm::vec3), sizeof(v));
+	return v;
+}
 
-		for(unsigned i = 0; i < triCount; ++i)
-		{
-			glm::vec3 p0, p1, p2;
+glm::vec3 StlView::Normal(std::size_t i) const
+{
+	glm::vec3 n;
+	std::memcpy(&n, Records() + i * StlRecordSize + offsetof(StlRecord, normal), sizeof(n));
+	return n;
+}
 
-			// skip normal
-			file.seekg(3 * 4, std::ios_base::cur);
+Triangle StlView::Get(std::size_t i) const
+{
+	Triangle t;
+	std::memcpy(&t, Records() + i * StlRecordSize + offsetof(StlRecord, vertices), sizeof(t));
+	return t;
+}
 
-			file.read((char*) &p0, sizeof(glm::vec3));
-			file.read((char*) &p1, sizeof(glm::vec3));
-			file.read((char*) &p2, sizeof(glm::vec3));
+static_assert(sizeof(Triangle) == 9 * sizeof(float), "triangles are nine packed floats");
+
+// A fixed-size copy: compilers turn it into a few unaligned vector moves, which
+// keeps up with memory bandwidth (hand-written SSE and AVX versions were no faster)
+void DecodeStl(const char* records, std::size_t n, Triangle* out)
+{
+	for (std::size_t i = 0; i < n; i++)
+		std::memcpy(&out[i], records + i * StlRecordSize + offsetof(StlRecord, vertices), sizeof(Triangle));
+}
 
-			// skip attribute
-			file.seekg(2, std::ios_base::cur);
+static std::vector<Triangle> decodeBinary(const char* records, std::size_t n, JobSystem* jobs)
+{
+	std::vector<Triangle> tris(n);
+	Triangle* out = tris.data();
+	auto range = [records, out](std::size_t b, std::size_t e) { DecodeStl(records + b * StlRecordSize, e - b, out + b); };
 
-			tris.push_back({p0, p1, p2});
+	if (jobs)
+		jobs->ParallelFor(0, n, 0, range);
+	else
+		range(0, n);
+	return tris;
+}
+
+/* ASCII */
+
+// Next whitespace separated token of [at, end), empty at the end of the text
+static inline bool nextToken(const char*& at, const char* end, const char*& token, std::size_t& length)
+{
+	SkipBlanks(at, end);
+	token = at;
+	while (at < end && !IsBlank(*at))
+		at++;
+	length = std::size_t(at - token);
+	return length != 0;
+}
+
+static inline bool isToken(const char* token, std::size_t length, const char* word, std::size_t wordLength)
+{
+	return length == wordLength && std::memcmp(token, word, length) == 0;
+}
+
+// Appends the facets of [at, end) to out
+static void parseAscii(const char* at, const char* end, std::vector<Triangle>& out)
+{
+	glm::vec3 v[3];
+	int vertices = 0;
+	const char* token;
+	std::size_t length;
+
+	while (nextToken(at, end, token, length))
+	{
+		if (isToken(token, length, "vertex", 6))
+		{
+			glm::vec3 p;
+			if (!ParseFloat(at, end, p.x) || !ParseFloat(at, end, p.y) || !ParseFloat(at, end, p.z))
+				continue;
+			if (vertices < 3)
+				v[vertices] = p;
+			vertices++;
+		}
+		else if (isToken(token, length, "endfacet", 8))
+		{
+			if (vertices == 3)
+				out.push_back({v[0], v[1], v[2]});
+			vertices = 0;
 		}
+	}
+}
+
+// Start of the facet following position at
+static const char* nextFacet(const char* text, std::size_t size, std::size_t at)
+{
+	static const char endfacet[] = "endfacet";
+	const char* end = text + size;
+	const char* found = std::search(text + at, end, endfacet, endfacet + 8);
+	return found == end ? end : found + 8;
+}
 
+std::vector<Triangle> ParseStlAscii(const char* text, std::size_t size, JobSystem* jobs)
+{
+	// A facet takes over 100 bytes of text
+	const std::size_t chunkBytes = std::size_t(1) << 20;
+	const std::size_t chunks = jobs ? (size + chunkBytes - 1) / chunkBytes : 1;
+	std::vector<Triangle> tris;
+	if (chunks <= 1)
+	{
+		tris.reserve(size / 128);
+		parseAscii(text, text + size, tris);
 		return tris;
 	}
-	else
+
+	// Every chunk starts after the first "endfacet" past its nominal start, so
+	// neighbours agree on the bounds and each facet is parsed exactly once
+	std::vector<std::vector<Triangle>> parts(chunks);
+	jobs->ParallelFor(0, chunks, 1, [&](std::size_t b, std::size_t e) {
+		for (std::size_t c = b; c < e; c++)
+		{
+			const char* begin = c == 0 ? text : nextFacet(text, size, c * chunkBytes);
+			const char* end = c + 1 == chunks ? text + size : nextFacet(text, size, (c + 1) * chunkBytes);
+			if (begin >= end)
+				continue;
+			parts[c].reserve(std::size_t(end - begin) / 128);
+			parseAscii(begin, end, parts[c]);
+		}
+	});
+
+	std::vector<std::size_t> offsets(chunks);
+	std::size_t total = 0;
+	for (std::size_t c = 0; c < chunks; c++)
+	{
+		offsets[c] = total;
+		total += parts[c].size();
+	}
+
+	tris.resize(total);
+	jobs->ParallelFor(0, chunks, 1, [&](std::size_t b, std::size_t e) {
+		for (std::size_t c = b; c < e; c++)
+			std::copy(parts[c].begin(), parts[c].end(), tris.begin() + offsets[c]);
+	});
+	return tris;
+}
+
+std::vector<Triangle> ReadStl(const StlView& view, JobSystem* jobs)
+{
+	return decodeBinary(view.Records(), view.TriangleCount(), jobs);
+}
+
+std::vector<Triangle> ReadStl(const char * filename, JobSystem* jobs)
+{
+	MappedFile file;
+	if (!file.Open(filename))
+		return {};
+
+	switch (DetectStl(file.Data(), file.Size()))
 	{
+	case StlFormat::Binary:
+		return decodeBinary(file.Data() + StlHeaderSize, announcedCount(file.Data()), jobs);
+	case StlFormat::Ascii:
+		return ParseStlAscii(file.Data(), file.Size(), jobs);
+	default:
 		return {};
 	}
 }
@@ -1,12 +1,86 @@
 #pragma once
 
+#include "mapped.h"
+
 #include <glm/vec3.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
+class JobSystem;
+
 struct Triangle
 {
 	glm::vec3 p0, p1, p2;
 };
 
-std::vector<Triangle> ReadStl(const char * filename);
+/* BINARY STL
+ * An 80-byte header, a little-endian uint32 triangle count, then one packed
+ * 50-byte record per triangle: normal, three vertices, a uint16 attribute.
+ *
+ * ASCII STL
+ * "solid name", then per triangle "facet normal nx ny nz", "outer loop",
+ * three "vertex x y z", "endloop" and "endfacet", and "endsolid name".
+ */
+
+constexpr std::size_t StlHeaderSize = 84;
+constexpr std::size_t StlRecordSize = 50;
+
+#pragma pack(push, 1)
+struct StlRecord
+{
+	float normal[3];
+	float vertices[9];
+	std::uint16_t attribute;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(StlRecord) == StlRecordSize, "STL records are packed");
+
+enum class StlFormat
+{
+	Binary,
+	Ascii,
+	Invalid
+};
+
+// Binary files may start with "solid" too: a file is only taken as ASCII when
+// it does not hold exactly the 84 + 50 * count bytes a binary header announces
+// and its start has no null byte, which text never has and floats mostly do.
+StlFormat DetectStl(const char* data, std::size_t size);
+
+// A binary STL file mapped in memory, its records read in place. Open checks
+// that the file is binary and holds the 84 + 50 * count bytes its header
+// announces (some exporters pad the end, which is ignored).
+class StlView
+{
+public:
+	bool Open(const char* filename);
+
+	std::size_t TriangleCount() const { return count; }
+	const char* Records() const { return file.Data() + StlHeaderSize; }
+
+	// Vertex k of triangle i and its normal, from the record. Records are 50
+	// bytes apart, so their floats are not aligned.
+	glm::vec3 Vertex(std::size_t i, int k) const;
+	glm::vec3 Normal(std::size_t i) const;
+	Triangle Get(std::size_t i) const;
+
+private:
+	MappedFile file;
+	std::size_t count = 0;
+};
+
+// Copies the vertices of n records into n triangles
+void DecodeStl(const char* records, std::size_t n, Triangle* out);
+
+// Triangles of the ASCII STL text. Tokens are read in place, numbers with
+// std::from_chars; facets without three vertices are skipped. With jobs, the
+// text is split in chunks after an "endfacet" and they are parsed in parallel.
+std::vector<Triangle> ParseStlAscii(const char* text, std::size_t size, JobSystem* jobs = nullptr);
+
+// Triangles of a binary or ASCII STL file, empty when it cannot be read. With
+// jobs, ranges of records are decoded in parallel.
+std::vector<Triangle> ReadStl(const char * filename, JobSystem* jobs = nullptr);
+std::vector<Triangle> ReadStl(const StlView& view, JobSystem* jobs = nullptr);
@@ -0,0 +1,41 @@
+#pragma once
+
+// Fixed step scheduler: frame times are accumulated and consumed in steps of
+// constant size, so the simulation cost per simulated second does not depend
+// on the frame rate. At most maxSubsteps steps run per frame; the time past
+// that is dropped (the simulation slows down instead of spiralling).
+class FixedTimestep
+{
+public:
+	double step = 1.0 / 120.0;
+	int maxSubsteps = 8;
+
+	// Adds the frame time and returns the number of steps to run
+	int Advance(double frameDt)
+	{
+		accumulator += frameDt;
+
+		int n = int(accumulator / step);
+		if (n > maxSubsteps)
+		{
+			droppedTime += accumulator - maxSubsteps * step;
+			accumulator = maxSubsteps * step;
+			n = maxSubsteps;
+		}
+
+		accumulator -= n * step;
+		totalSteps += n;
+		return n;
+	}
+
+	// Fraction of a step left in the accumulator, to blend the last two states
+	float Alpha() const { return float(accumulator / step); }
+
+	long long TotalSteps() const { return totalSteps; }
+	double DroppedTime() const { return droppedTime; }
+
+private:
+	double accumulator = 0.0;
+	double droppedTime = 0.0;
+	long long totalSteps = 0;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Wait-free single producer, single consumer triple buffer.
+// The writer fills its back slot and swaps it with the middle one; the reader
+// swaps its front slot with the middle one when the middle holds a newer
+// state. Each side always owns one slot and a swap is one atomic exchange, so
+// neither side ever waits for the other. States published between two reads
+// are skipped: the reader only ever sees the latest one.
+template<typename T>
+class TripleBuffer
+{
+public:
+	// Any slot, to set them up before the two sides start
+	T& Slot(int i) { return slots[i]; }
+
+	// Writer side
+	T& Back() { return slots[back]; }
+	void Publish() { back = middle.exchange(std::uint8_t(back | Fresh), std::memory_order_acq_rel) & Index; }
+
+	// Reader side. Update takes the latest published state, if there is a
+	// new one, and returns whether Front changed.
+	bool Update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & Fresh))
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & Index;
+		return true;
+	}
+	T& Front() { return slots[front]; }
+
+private:
+	static constexpr std::uint8_t Index = 3, Fresh = 4;
+
+	T slots[3];
+	std::uint8_t back = 0, front = 1; // owned by the writer and the reader
+	std::atomic<std::uint8_t> middle{2}; // slot index, with Fresh set by Publish
+};
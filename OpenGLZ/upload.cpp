@@ -0,0 +1,56 @@
+#include "upload.h"
+
+UploadRing::~UploadRing()
+{
+	for (auto& f : fences)
+	{
+		if (f)
+			glDeleteSync(f);
+	}
+
+	if (buffer)
+	{
+		glUnmapNamedBuffer(buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+}
+
+void UploadRing::Create(std::size_t size)
+{
+	regionSize = size;
+
+	// Coherent: the writes are visible to the GPU without explicit flushes
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glCreateBuffers(1, &buffer);
+	glNamedBufferStorage(buffer, Regions * regionSize, nullptr, flags);
+	mapped = (char*) glMapNamedBufferRange(buffer, 0, Regions * regionSize, flags);
+}
+
+void* UploadRing::Begin()
+{
+	current = (current + 1) % Regions;
+
+	GLsync& fence = fences[current];
+	if (fence)
+	{
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			stalls++;
+			do
+			{
+				status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while (status == GL_TIMEOUT_EXPIRED);
+		}
+
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	return mapped + Offset();
+}
+
+void UploadRing::End()
+{
+	fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
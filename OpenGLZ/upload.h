@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Persistently mapped vertex buffer split in regions used round robin.
+// The CPU writes a frame straight into the mapped region while the GPU may
+// still read the previous ones; a fence per region guards the reuse of a
+// region whose draw has not completed yet. GpuCheck runs it without a display.
+class UploadRing
+{
+public:
+	static constexpr int Regions = 3;
+
+	UploadRing() = default;
+	~UploadRing();
+
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	// Creates an immutable buffer of Regions * regionSize bytes, mapped once
+	void Create(std::size_t regionSize);
+
+	GLuint Buffer() const { return buffer; }
+
+	// Waits until the GPU is done with the next region and returns its memory
+	void* Begin();
+	// Byte offset of the region returned by the last Begin
+	std::size_t Offset() const { return std::size_t(current) * regionSize; }
+	// Fences the region, after the commands reading it were issued
+	void End();
+
+	// Number of Begin calls that had to wait for the GPU
+	long long Stalls() const { return stalls; }
+
+private:
+	GLuint buffer = 0;
+	char* mapped = nullptr;
+	std::size_t regionSize = 0;
+	int current = Regions - 1;
+	GLsync fences[Regions] = {};
+	long long stalls = 0;
+};
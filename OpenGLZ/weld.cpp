@@ -0,0 +1,168 @@
+#include "weld.h"
+
+#include "jobs.h"
+#include "meshparse.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+struct WeldKey
+{
+	std::uint32_t x, y, z;
+
+	bool operator==(const WeldKey& k) const { return x == k.x && y == k.y && z == k.z; }
+};
+
+// Open addressing with linear probing over the indices of a key array
+class WeldTable
+{
+public:
+	static constexpr std::uint32_t Empty = ~0u;
+
+	explicit WeldTable(std::size_t count)
+	{
+		std::size_t capacity = 16;
+		while (capacity < 2 * count)
+			capacity *= 2;
+		slots.assign(capacity, Empty);
+		mask = capacity - 1;
+	}
+
+	// Index of the key equal to key, or candidate after inserting it
+	std::uint32_t Insert(const WeldKey& key, std::uint32_t candidate, const std::vector<WeldKey>& keys)
+	{
+		for (std::size_t s = HashTriple(key.x, key.y, key.z) & mask;; s = (s + 1) & mask)
+		{
+			if (slots[s] == Empty)
+			{
+				slots[s] = candidate;
+				return candidate;
+			}
+			if (keys[slots[s]] == key)
+				return slots[s];
+		}
+	}
+
+private:
+	std::vector<std::uint32_t> slots;
+	std::size_t mask;
+};
+
+// Corners of a range of triangles welded on their own
+struct WeldChunk
+{
+	std::vector<WeldKey> keys;
+	std::vector<glm::vec3> positions;
+	std::vector<std::uint32_t> remap; // local vertex to mesh vertex
+};
+
+// Runs fn over the ranges of chunk triangles, so ranges are the same with or without jobs
+static void forEachRange(std::size_t n, std::size_t chunk, JobSystem* jobs, const RangeFunction& fn)
+{
+	if (jobs)
+		jobs->ParallelFor(0, n, chunk, fn);
+	else
+	{
+		for (std::size_t b = 0; b < n; b += chunk)
+			fn(b, std::min(b + chunk, n));
+	}
+}
+
+static std::uint32_t quantize(float x, float inverse)
+{
+	if (inverse == 0.f)
+	{
+		// Exact match, -0 and 0 being the same point
+		std::uint32_t bits;
+		x += 0.f;
+		std::memcpy(&bits, &x, 4);
+		return bits;
+	}
+	const float q = std::floor(x * inverse + 0.5f);
+	return std::uint32_t(std::int32_t(std::min(std::max(q, -2147483648.f), 2147483520.f)));
+}
+
+IndexedMesh WeldMesh(const std::vector<Triangle>& triangles, float tolerance, JobSystem* jobs)
+{
+	IndexedMesh mesh;
+	const std::size_t n = triangles.size();
+	if (n == 0)
+		return mesh;
+
+	const float inverse = tolerance > 0.f ? 1.f / tolerance : 0.f;
+	const std::size_t chunk = 16384; // triangles per range
+	const std::size_t chunks = (n + chunk - 1) / chunk;
+
+	// Corners first get their index in the vertices of their range
+	std::vector<std::uint32_t> indices(3 * n);
+	std::vector<WeldChunk> parts(chunks);
+	auto weldRange = [&](std::size_t b, std::size_t e) {
+		WeldChunk& part = parts[b / chunk];
+		part.keys.reserve(3 * (e - b));
+		part.positions.reserve(3 * (e - b));
+		WeldTable table(3 * (e - b));
+
+		for (std::size_t i = 3 * b; i < 3 * e; i++)
+		{
+			const glm::vec3& p = (&triangles[i / 3].p0)[i % 3];
+			const WeldKey key = {quantize(p.x, inverse), quantize(p.y, inverse), quantize(p.z, inverse)};
+			const std::uint32_t local = std::uint32_t(part.keys.size());
+			part.keys.push_back(key);
+
+			const std::uint32_t found = table.Insert(key, local, part.keys);
+			if (found == local)
+				part.positions.push_back(p);
+			else
+				part.keys.pop_back();
+			indices[i] = found;
+		}
+	};
+
+	forEachRange(n, chunk, jobs, weldRange);
+
+	// Vertices shared by several ranges are merged in range order
+	std::size_t unique = 0;
+	for (const WeldChunk& part : parts)
+		unique += part.keys.size();
+
+	std::vector<WeldKey> keys;
+	keys.reserve(unique);
+	mesh.vertices.reserve(unique);
+	WeldTable table(unique);
+	for (WeldChunk& part : parts)
+	{
+		part.remap.resize(part.keys.size());
+		for (std::size_t v = 0; v < part.keys.size(); v++)
+		{
+			const std::uint32_t global = std::uint32_t(keys.size());
+			keys.push_back(part.keys[v]);
+
+			part.remap[v] = table.Insert(part.keys[v], global, keys);
+			if (part.remap[v] == global)
+				mesh.vertices.push_back(part.positions[v]);
+			else
+				keys.pop_back();
+		}
+	}
+
+	const bool small = mesh.vertices.size() <= 0x10000;
+	if (small)
+		mesh.indices16.resize(3 * n);
+	else
+		mesh.indices32.resize(3 * n);
+
+	auto remapRange = [&](std::size_t b, std::size_t e) {
+		const std::vector<std::uint32_t>& remap = parts[b / chunk].remap;
+		for (std::size_t i = 3 * b; i < 3 * e; i++)
+		{
+			if (small)
+				mesh.indices16[i] = std::uint16_t(remap[indices[i]]);
+			else
+				mesh.indices32[i] = remap[indices[i]];
+		}
+	};
+
+	forEachRange(n, chunk, jobs, remapRange);
+	return mesh;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "stl.h"
+
+#include <glm/vec3.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+// Shared vertices and three indices per triangle. Only one of the index
+// buffers is filled: the 16-bit one when every index fits.
+struct IndexedMesh
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<std::uint16_t> indices16;
+	std::vector<std::uint32_t> indices32;
+
+	std::size_t IndexSize() const { return indices32.empty() ? 2 : 4; }
+	std::size_t IndexCount() const { return indices32.empty() ? indices16.size() : indices32.size(); }
+	std::uint32_t Index(std::size_t i) const { return indices32.empty() ? indices16[i] : indices32[i]; }
+	std::size_t Bytes() const { return vertices.size() * sizeof(glm::vec3) + IndexCount() * IndexSize(); }
+};
+
+// Merges the corners of a triangle soup into shared vertices. Corners are
+// keyed by their position snapped to a grid of step tolerance (their exact
+// bits with tolerance 0), so corners closer than tolerance merge unless a
+// grid plane passes between them; a merged vertex keeps the first position.
+// With jobs, ranges of triangles are welded in parallel into their own hash
+// tables, then their vertices are merged in order: the result does not
+// depend on the thread count.
+IndexedMesh WeldMesh(const std::vector<Triangle>& triangles, float tolerance = 0.f, JobSystem* jobs = nullptr);